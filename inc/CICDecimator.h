@@ -0,0 +1,104 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalConfig.h"
+
+#ifndef CIC_DECIMATOR_H
+#define CIC_DECIMATOR_H
+
+// The maximum number of integrator/comb stages supported.
+#define CIC_DECIMATOR_MAX_STAGES        4
+
+/**
+ * A cascaded integrator-comb (CIC) decimation filter for 1 bit PDM data, followed by a
+ * three tap FIR stage that compensates for the passband droop of the CIC.
+ *
+ * Integer only, and independent of any hardware, so the same filter can be run on the host.
+ * The integrators are advanced a byte at a time, using tables of the contribution of each byte
+ * value to each stage, so the cost per input byte is one lookup per stage.
+ */
+class CICDecimator
+{
+    uint32_t    integrator[CIC_DECIMATOR_MAX_STAGES];   // Integrator state, updated at the PDM rate.
+    uint32_t    comb[CIC_DECIMATOR_MAX_STAGES];         // Comb state, updated at the PCM rate.
+    int32_t     history[2];                             // The last two CIC outputs, used by the compensation stage.
+    int         stages;                                 // The number of integrator/comb stages in use.
+    int         decimation;                             // The number of PDM samples per PCM sample.
+    int         gain;                                   // log2 of the DC gain of the CIC (decimation^stages).
+    int         compensation;                           // Compensation FIR side tap, in Q8.
+
+public:
+
+    /**
+     * Constructor.
+     *
+     * @param decimation The number of PDM samples per PCM sample. Must be a power of two between 16 and 256.
+     * @param stages The number of integrator/comb stages, between 1 and CIC_DECIMATOR_MAX_STAGES.
+     */
+    CICDecimator(int decimation = 64, int stages = CIC_DECIMATOR_MAX_STAGES);
+
+    /**
+     * Changes the decimation ratio and number of stages of this filter, and resets its state.
+     * Higher stage counts give better rejection of aliased noise at a higher cost per sample.
+     *
+     * @param decimation The number of PDM samples per PCM sample. Must be a power of two between 16 and 256.
+     * @param stages The number of integrator/comb stages, between 1 and CIC_DECIMATOR_MAX_STAGES.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the configuration is not supported
+     * (including those where decimation^stages exceeds 2^31).
+     */
+    int configure(int decimation, int stages);
+
+    /**
+     * Clears all filter state.
+     */
+    void reset();
+
+    /**
+     * Feeds 16 PDM samples into the integrators.
+     *
+     * @param bits The PDM samples, in the low 16 bits. Bit 0 is the chronologically first sample.
+     */
+    void integrate(uint32_t bits);
+
+    /**
+     * Generates a PCM sample from the PDM data integrated since the last call.
+     * Should be called after every (decimation / 16) calls to integrate().
+     *
+     * @return a signed 16 bit PCM sample.
+     */
+    int16_t decimate();
+
+    /**
+     * Determines the decimation ratio of this filter.
+     */
+    int getDecimation();
+
+    /**
+     * Determines the number of integrator/comb stages in this filter.
+     */
+    int getStages();
+};
+
+#endif
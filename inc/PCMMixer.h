@@ -0,0 +1,156 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalConfig.h"
+#include "DataStream.h"
+
+#ifndef PCM_MIXER_H
+#define PCM_MIXER_H
+
+// The largest number of inputs that can be mixed.
+#ifndef PCM_MIXER_MAX_INPUTS
+#define PCM_MIXER_MAX_INPUTS            4
+#endif
+
+// The number of buffers each input may hold awaiting mixing. Further buffers are pulled as these are consumed.
+#ifndef PCM_MIXER_INPUT_QUEUE_SIZE
+#define PCM_MIXER_INPUT_QUEUE_SIZE      2
+#endif
+
+// The number of output buffers preallocated by each mixer. This should exceed the number held downstream (e.g. SAMD21DAC_QUEUE_SIZE).
+#ifndef PCM_MIXER_POOL_SIZE
+#define PCM_MIXER_POOL_SIZE             4
+#endif
+
+// The default number of samples in each mixed output buffer.
+#ifndef PCM_MIXER_DEFAULT_BLOCK_SIZE
+#define PCM_MIXER_DEFAULT_BLOCK_SIZE    256
+#endif
+
+// The unity setting of each input gain (gain is expressed in 1/256ths).
+#define PCM_MIXER_UNITY_GAIN            256
+
+using namespace codal;
+
+class PCMMixer;
+
+/**
+ * A single input to a PCMMixer, receiving data from one upstream component.
+ */
+class PCMMixerInput : public DataSink
+{
+    friend class PCMMixer;
+
+    PCMMixer        *mixer;                                 // The mixer this input belongs to.
+    DataSource      *source;                                // The component producing our data, or NULL if this input is unused.
+    int             gain;                                   // The gain applied to this input, in 1/256ths.
+    int             dataReady;                              // The number of buffers announced by our source, but not yet pulled.
+    ManagedBuffer   queue[PCM_MIXER_INPUT_QUEUE_SIZE];      // Buffers awaiting mixing.
+    uint32_t        queueHead;                              // The number of buffers consumed. The oldest is in slot queueHead % PCM_MIXER_INPUT_QUEUE_SIZE.
+    uint32_t        queueTail;                              // The number of buffers pulled. The next is pulled into slot queueTail % PCM_MIXER_INPUT_QUEUE_SIZE.
+    int             position;                               // The number of samples already consumed from the oldest buffer.
+    int             available;                              // The total number of samples awaiting mixing.
+
+    void fill();
+
+public:
+
+    /**
+     * Callback provided when data is ready.
+     */
+    virtual int pullRequest();
+};
+
+/**
+ * A mixer for signed 16 bit mono PCM streams.
+ *
+ * Each input pulls from its source as soon as data is announced. Mixing takes place as each output buffer is pulled
+ * downstream, in a single pass that applies each input's gain and accumulates and saturates in fixed point.
+ * Inputs with no data waiting contribute silence, so short sounds can be mixed over a continuous background stream.
+ * Output buffers are drawn from a preallocated pool, so no heap allocation takes place once the mixer is running.
+ */
+class PCMMixer : public DataSource
+{
+    friend class PCMMixerInput;
+
+    PCMMixerInput   inputs[PCM_MIXER_MAX_INPUTS];           // Our inputs.
+    BufferData      *pool[PCM_MIXER_POOL_SIZE];             // Preallocated output buffers, each holding a permanent reference from this component.
+    uint16_t        poolIdleReference;                      // The reference count of a pooled buffer that is not in use elsewhere.
+    uint32_t        poolExhausted;                          // The number of times an output buffer was unavailable as all were in use.
+    int             blockSize;                              // The number of samples in each output buffer.
+    int             requested;                              // The number of output buffers announced downstream, but not yet pulled.
+
+    void update();
+
+public:
+
+    // The stream component that is serving our data.
+    DataStream output;
+
+    /**
+     * Constructor for a mixer with no inputs.
+     *
+     * @param blockSize The number of samples in each mixed output buffer.
+     */
+    PCMMixer(int blockSize = PCM_MIXER_DEFAULT_BLOCK_SIZE);
+
+    /**
+     * Adds an input to the mixer, and connects it to the given source.
+     *
+     * @param source The component producing signed 16 bit mono PCM samples.
+     * @param gain The gain applied to the input, in 1/256ths (PCM_MIXER_UNITY_GAIN is unity).
+     *
+     * @return the index of the new input, or DEVICE_NO_RESOURCES if PCM_MIXER_MAX_INPUTS are already in use.
+     */
+    int addInput(DataSource &source, int gain = PCM_MIXER_UNITY_GAIN);
+
+    /**
+     * Sets the gain applied to the given input.
+     *
+     * @param input The index of the input, as returned by addInput().
+     * @param gain The gain, in 1/256ths (PCM_MIXER_UNITY_GAIN is unity). Up to 16x (4096) is supported.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the input or gain is out of range.
+     */
+    int setGain(int input, int gain);
+
+    /**
+     * Determines how often an output buffer could not be provided because all were still held downstream.
+     *
+     * @return the number of output buffers dropped since this component was created.
+     */
+    uint32_t getPoolExhaustedCount();
+
+    /**
+     * Mix the data waiting at each input into a new output buffer, and provide it to our downstream component.
+     */
+    virtual ManagedBuffer pull();
+
+    /**
+     * Register a downstream component to receive mixed buffers.
+     */
+    virtual void connect(DataSink &sink);
+};
+
+#endif
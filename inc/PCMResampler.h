@@ -0,0 +1,152 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalConfig.h"
+#include "DataStream.h"
+
+#ifndef PCM_RESAMPLER_H
+#define PCM_RESAMPLER_H
+
+//
+// Interpolation methods.
+//
+#define PCM_RESAMPLER_LINEAR            0       // Linear interpolation between adjacent samples. Cheapest, but attenuates and aliases high frequencies.
+#define PCM_RESAMPLER_POLYPHASE         1       // Kaiser windowed sinc interpolation, from a table of filter phases.
+
+// The number of taps in each phase of the polyphase filter.
+#define PCM_RESAMPLER_TAPS              8
+
+// The number of filter phases held in the table, per input sample period. Coefficients between phases are interpolated linearly.
+#define PCM_RESAMPLER_PHASES            64
+
+// The largest number of interleaved channels supported.
+#define PCM_RESAMPLER_MAX_CHANNELS      2
+
+// The number of output buffers preallocated by each resampler. One is retained as the most recent output,
+// so this should exceed the number held downstream by at least one.
+#ifndef PCM_RESAMPLER_POOL_SIZE
+#define PCM_RESAMPLER_POOL_SIZE         3
+#endif
+
+// The number of output sample frames each pooled buffer is initially allocated to hold. A buffer is enlarged if a larger block arrives.
+#ifndef PCM_RESAMPLER_DEFAULT_BLOCK_SIZE
+#define PCM_RESAMPLER_DEFAULT_BLOCK_SIZE 256
+#endif
+
+using namespace codal;
+
+/**
+ * A fractional sample rate converter for signed 16 bit PCM streams.
+ *
+ * Hardware sample rates are often a rounded approximation of the rate requested. For example, SAMD21PDM derives its
+ * PDM clock from 48MHz by an integer divisor. This stage converts such a stream to an exact output rate. The rate ratio
+ * is tracked as an exact fraction, so no drift accumulates over time.
+ *
+ * For example, a SAMD21PDM microphone is converted to exactly 16kHz by:
+ *
+ *     PCMResampler resampler(mic.output, mic.getClockRate(), 16000 * mic.getDecimation());
+ *
+ * The polyphase filter is flat (within 0.1dB) to half of the input Nyquist frequency, 3dB down at 80% of it, and 6dB
+ * down at its cutoff of 90% of it.
+ * It is intended for conversion ratios close to unity (within around 10%). Larger reductions in rate should be made
+ * by decimation upstream.
+ *
+ * Output buffers are drawn from a preallocated pool, and the input scratch buffer only grows when a larger block
+ * arrives, so no heap allocation takes place once the resampler is running with a steady block size.
+ */
+class PCMResampler : public DataSink, public DataSource
+{
+private:
+
+    DataSource      &upstream;                          // The component producing our PCM input.
+    int             method;                             // One of PCM_RESAMPLER_LINEAR or PCM_RESAMPLER_POLYPHASE.
+    int             channels;                           // The number of interleaved channels in the stream.
+    uint32_t        inputRate;                          // The input sample rate, scaled by the same factor as outputRate.
+    uint32_t        outputRate;                         // The output sample rate, scaled by the same factor as inputRate.
+    uint32_t        step;                               // The whole number of input samples between output samples.
+    uint32_t        stepFraction;                       // The fractional number of input samples between output samples, in 1/2^32ths.
+    uint32_t        stepError;                          // The remainder of stepFraction, in 1/(2^32 * outputRate)ths.
+    int             position;                           // The index of the input sample preceding the next output sample.
+    uint32_t        fraction;                           // The position of the next output sample between input samples, in 1/2^32ths.
+    uint32_t        error;                              // The accumulated remainder of fraction, in 1/(2^32 * outputRate)ths.
+    int16_t         history[PCM_RESAMPLER_MAX_CHANNELS][PCM_RESAMPLER_TAPS];  // The most recent input samples, for filtering across buffers.
+    ManagedBuffer   input;                              // Scratch space holding the history followed by the latest input buffer, for one channel.
+    ManagedBuffer   buffer;                             // The most recent output buffer.
+    BufferData      *pool[PCM_RESAMPLER_POOL_SIZE];     // Preallocated output buffers, each holding a permanent reference from this component.
+    uint16_t        poolCapacity[PCM_RESAMPLER_POOL_SIZE];  // The number of bytes each pooled buffer can hold.
+    uint16_t        poolIdleReference;                  // The reference count of a pooled buffer that is not in use elsewhere.
+    uint32_t        poolExhausted;                      // The number of output blocks dropped because every pooled buffer was in use.
+
+public:
+
+    // The stream component that is serving our data.
+    DataStream output;
+
+    /**
+     * Constructor for a resampler, which connects itself to the given source.
+     * Only the ratio of inputRate to outputRate is significant, so a fractional rate can be given exactly by scaling
+     * both. For example, a source producing n/d Hz is converted to r Hz with an inputRate of n and an outputRate of d * r.
+     *
+     * @param source The component producing signed 16 bit PCM samples.
+     * @param inputRate The sample rate of the source.
+     * @param outputRate The sample rate required.
+     * @param channels The number of interleaved channels in the stream (1 or 2).
+     * @param method One of PCM_RESAMPLER_LINEAR or PCM_RESAMPLER_POLYPHASE.
+     */
+    PCMResampler(DataSource &source, uint32_t inputRate, uint32_t outputRate, int channels = 1, int method = PCM_RESAMPLER_POLYPHASE);
+
+    /**
+     * Changes the conversion ratio. Only the ratio of inputRate to outputRate is significant.
+     *
+     * @param inputRate The sample rate of the source.
+     * @param outputRate The sample rate required.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if either rate is zero.
+     */
+    int setRates(uint32_t inputRate, uint32_t outputRate);
+
+    /**
+     * Determines how often a block of output was dropped because every buffer in the pool was still held downstream.
+     *
+     * @return The number of output blocks dropped since the resampler was created.
+     */
+    uint32_t getPoolExhaustedCount();
+
+    /**
+     * Callback provided when data is ready.
+     */
+    virtual int pullRequest();
+
+    /**
+     * Provide the most recent resampled buffer to our downstream component.
+     */
+    virtual ManagedBuffer pull();
+
+    /**
+     * Register a downstream component to receive each buffer as it is resampled.
+     */
+    virtual void connect(DataSink &sink);
+};
+
+#endif
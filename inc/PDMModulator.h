@@ -0,0 +1,78 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalConfig.h"
+
+#ifndef PDM_MODULATOR_H
+#define PDM_MODULATOR_H
+
+/**
+ * A second order sigma-delta modulator, that converts PCM samples into a 1 bit PDM bitstream.
+ *
+ * The bitstream uses the layout that SAMD21PDM receives from the I2S peripheral, so this can be used to
+ * generate stimulus for the decimation filters (e.g. on the host, where no microphone is available).
+ * Integer only, and independent of any hardware.
+ */
+class PDMModulator
+{
+    int32_t     integrator[2];                          // The state of the two integrator stages.
+    int16_t     previous;                               // The last PCM sample modulated, used for interpolation.
+
+public:
+
+    /**
+     * Constructor.
+     */
+    PDMModulator();
+
+    /**
+     * Clears all modulator state.
+     */
+    void reset();
+
+    /**
+     * Generates 16 PDM samples representing the given PCM sample.
+     *
+     * @param sample A signed 16 bit PCM sample. The modulator is stable for samples within 3/4 of full scale.
+     *
+     * @return the PDM samples in the low 16 bits. Bit 0 is the chronologically first sample.
+     */
+    uint16_t modulate(int16_t sample);
+
+    /**
+     * Generates a PDM bitstream from a buffer of PCM samples, interpolating linearly between them.
+     * The PDM data for each sample is written into one half of (decimation / 16) consecutive 32 bit words,
+     * as received from the I2S peripheral. The other half of each word is left unchanged, so two modulators can
+     * be used to generate a stereo bitstream.
+     *
+     * @param pcm The PCM samples to modulate.
+     * @param length The number of PCM samples.
+     * @param pdm The buffer to write PDM data into. Must hold (length * decimation / 16) words.
+     * @param decimation The number of PDM samples per PCM sample. Must be a multiple of 16.
+     * @param channel 0 to write the low half word (left channel), 1 to write the high half word (right channel).
+     */
+    void modulate(const int16_t *pcm, int length, uint32_t *pdm, int decimation, int channel = 0);
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalConfig.h"
+
+#ifndef SAMD21_CLOCK_PLANNER_H
+#define SAMD21_CLOCK_PLANNER_H
+
+// The maximum number of clock sources a planner can choose between, in addition to the DPLL.
+#define SAMD21_CLOCK_PLANNER_MAX_SOURCES    4
+
+// The longest pattern of timer periods that may be cycled through to dither the sample period.
+#ifndef SAMD21_CLOCK_PLANNER_DITHER_MAX
+#define SAMD21_CLOCK_PLANNER_DITHER_MAX     512
+#endif
+
+// The fastest clock a timer may be driven from.
+#define SAMD21_CLOCK_PLANNER_TC_MAX         48000000
+
+// The output range of the fractional digital phase locked loop (FDPLL96M), and its largest multiplier.
+#define SAMD21_CLOCK_PLANNER_DPLL_MIN       48000000
+#define SAMD21_CLOCK_PLANNER_DPLL_MAX       96000000
+#define SAMD21_CLOCK_PLANNER_DPLL_LDR_MAX   4095
+
+// The largest division ratio of a clock generator fed by the DPLL (generators 3 to 8 have an 8 bit divider).
+#define SAMD21_CLOCK_PLANNER_GCLK_DIV_MAX   255
+
+// The largest timer period, in timer clock ticks (16 bit timer, in match frequency mode).
+#define SAMD21_CLOCK_PLANNER_PERIOD_MAX     65536
+
+/**
+ * A configuration of clock generator, DPLL and timer that generates a sample clock.
+ */
+struct SAMD21ClockPlan
+{
+    int         generator;                              // The clock generator driving the timer.
+    bool        dpll;                                   // true if the generator is to be driven by the DPLL.
+    uint32_t    dpllRatio;                              // The integer part of the DPLL multiplier, less one (DPLLRATIO.LDR).
+    uint32_t    dpllFraction;                           // The fractional part of the DPLL multiplier, in 1/16ths (DPLLRATIO.LDRFRAC).
+    uint32_t    divider;                                // The division ratio of the generator, when driven by the DPLL.
+    uint32_t    clock;                                  // The frequency of the timer's clock, rounded to the nearest Hz.
+    uint32_t    period;                                 // The sample period, in timer clock ticks.
+    uint32_t    ditherCount;                            // The number of periods in every ditherLength that are one tick longer.
+    uint32_t    ditherLength;                           // The length of the dither pattern. One if the period is not dithered.
+    int32_t     error;                                  // The error in the average sample rate, in parts per billion. Positive if fast.
+};
+
+/**
+ * Plans the configuration of clock generators, DPLL and timer that most accurately generates a given sample rate.
+ *
+ * Each clock source is considered with a timer whose period is dithered: over a repeating pattern of ditherLength
+ * sample periods, ditherCount are one tick longer than the others, so the long term average rate can be an exact
+ * fraction of the clock. Where a DPLL reference is available, clocks that are an exact multiple of the sample rate
+ * are also considered, which avoid the jitter of dithering. The most accurate plan is chosen, preferring no
+ * dither, and then clocks that are already running.
+ *
+ * Integer only, and independent of any hardware, so plans can be checked on the host.
+ */
+class SAMD21ClockPlanner
+{
+    uint32_t    sourceFrequency[SAMD21_CLOCK_PLANNER_MAX_SOURCES];  // The frequency of each clock source.
+    int         sourceGenerator[SAMD21_CLOCK_PLANNER_MAX_SOURCES];  // The clock generator providing each clock source.
+    int         sources;                                            // The number of clock sources.
+    uint32_t    dpllReference;                                      // The frequency of the DPLL's reference clock, or zero if unavailable.
+    int         dpllGenerator;                                      // The clock generator that may be driven by the DPLL.
+    uint32_t    ditherMax;                                          // The longest dither pattern permitted.
+
+    /**
+     * Computes the error of a sample clock, in parts per billion.
+     */
+    static int32_t error(uint64_t clock, uint64_t ticks, uint32_t rate);
+
+    /**
+     * Determines if one plan is better than another.
+     */
+    static bool better(SAMD21ClockPlan &candidate, SAMD21ClockPlan &best);
+
+public:
+
+    /**
+     * Constructor. Creates a planner with no clock sources.
+     */
+    SAMD21ClockPlanner();
+
+    /**
+     * Adds a clock generator that is already running, and may drive the timer directly.
+     *
+     * @param generator The clock generator.
+     * @param frequency The frequency of the generator, in Hz. At most SAMD21_CLOCK_PLANNER_TC_MAX.
+     *
+     * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the frequency is out of range, or
+     * DEVICE_NO_RESOURCES if SAMD21_CLOCK_PLANNER_MAX_SOURCES have already been added.
+     */
+    int addSource(int generator, uint32_t frequency);
+
+    /**
+     * Allows the DPLL to be used, driving the given clock generator.
+     *
+     * @param reference The frequency of the DPLL's reference clock, in Hz, or zero to disallow use of the DPLL.
+     * @param generator The clock generator to be driven by the DPLL. Must have an 8 bit divider (generators 3 to 8).
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the reference is out of the DPLL's range (32kHz to 2MHz).
+     */
+    int setDpll(uint32_t reference, int generator);
+
+    /**
+     * Limits the length of the dither pattern, for instance where no DMA channel is available to apply it.
+     *
+     * @param length The longest dither pattern permitted, between 1 (no dithering) and SAMD21_CLOCK_PLANNER_DITHER_MAX.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the length is out of range.
+     */
+    int setDitherLimit(uint32_t length);
+
+    /**
+     * Plans the most accurate sample clock for the given rate.
+     *
+     * @param rate The sample rate, in Hz.
+     * @param plan The plan to fill in.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if no clock source can generate the rate.
+     */
+    int plan(uint32_t rate, SAMD21ClockPlan &plan);
+
+    /**
+     * Fills in the sequence of timer periods that dithers the sample period of a plan, with the longer periods spread
+     * evenly through the pattern. Each entry is the value of the timer's top (CC0) register, one less than the period.
+     *
+     * @param plan The plan.
+     * @param pattern An array of plan.ditherLength entries to fill in.
+     */
+    static void fillDitherPattern(SAMD21ClockPlan &plan, uint16_t *pattern);
+};
+
+#endif
@@ -26,6 +26,7 @@ DEALINGS IN THE SOFTWARE.
 #include "Timer.h"
 #include "Pin.h"
 #include "SAMD21DMAC.h"
+#include "SAMD21ClockPlanner.h"
 #include "DataStream.h"
 
 #ifndef SAMD21DAC_H
@@ -35,6 +36,129 @@ DEALINGS IN THE SOFTWARE.
 #define SAMD21DAC_DEFAULT_FREQUENCY 44100
 #endif
 
+//
+// The clocks from which the sample clock may be derived: the main clock (generator 0) and 8MHz peripheral clock (generator 1).
+//
+#ifndef SAMD21DAC_MAIN_CLOCK
+#define SAMD21DAC_MAIN_CLOCK        48000000
+#endif
+
+#ifndef SAMD21DAC_PERIPHERAL_CLOCK
+#define SAMD21DAC_PERIPHERAL_CLOCK  8000000
+#endif
+
+//
+// The frequency of the DPLL's reference clock, or zero if the DPLL may not be used to generate the sample clock.
+// The reference is selected by SAMD21DAC_DPLL_REFCLK (0: XOSC32K, 1: XOSC), and must already be running.
+// When used, the DPLL drives clock generator SAMD21DAC_DPLL_GCLK.
+//
+#ifndef SAMD21DAC_DPLL_REFERENCE
+#define SAMD21DAC_DPLL_REFERENCE    0
+#endif
+
+#ifndef SAMD21DAC_DPLL_REFCLK
+#define SAMD21DAC_DPLL_REFCLK       0
+#endif
+
+#ifndef SAMD21DAC_DPLL_GCLK
+#define SAMD21DAC_DPLL_GCLK         7
+#endif
+
+//
+// The number of buffers that can be queued for playback. Each has its own DMA descriptor, linked to the next as it is
+// queued, so that playback moves from one buffer to the next without the DMA channel going idle. At least two are required.
+// SAMD21DAC_QUEUE_SIZE linked descriptors are required from the DMA controller.
+//
+#ifndef SAMD21DAC_QUEUE_SIZE
+#define SAMD21DAC_QUEUE_SIZE 3
+#endif
+
+//
+// The number of samples each slot's staging buffer holds. Buffers that must be converted or scaled are staged, and
+// are refused if they are longer than this. Staging buffers are allocated once, so that no heap allocation takes place
+// as buffers are queued from the completion interrupt.
+//
+#ifndef SAMD21DAC_STAGING_SIZE
+#define SAMD21DAC_STAGING_SIZE 512
+#endif
+
+//
+// Input sample formats. Samples in any format other than SAMD21DAC_FORMAT_NATIVE are converted into a staging buffer
+// as they are queued, in a single pass.
+//
+#define SAMD21DAC_FORMAT_NATIVE     0       // Unsigned 10 bit samples in 16 bit words, written directly to the DAC.
+#define SAMD21DAC_FORMAT_S16        1       // Signed 16 bit.
+#define SAMD21DAC_FORMAT_U16        2       // Unsigned 16 bit.
+#define SAMD21DAC_FORMAT_S8         3       // Signed 8 bit.
+#define SAMD21DAC_FORMAT_U8         4       // Unsigned 8 bit.
+
+//
+// Underrun policies, determining what is played when the playback queue runs dry.
+//
+#define SAMD21DAC_UNDERRUN_HOLD     0       // Stop, holding the last sample played.
+#define SAMD21DAC_UNDERRUN_RAMP     1       // Ramp smoothly from the last sample played to midscale, then stop.
+#define SAMD21DAC_UNDERRUN_SILENCE  2       // Loop midscale silence until data arrives, keeping the DMA channel running.
+
+// The number of samples in the ramp and silence buffers played on underrun. Queued data follows on from silence at the
+// end of its current block, so this also determines how long data may wait behind silence.
+#ifndef SAMD21DAC_FILL_SIZE
+#define SAMD21DAC_FILL_SIZE         64
+#endif
+
+// The DAC output value representing silence.
+#define SAMD21DAC_MIDSCALE          512
+
+//
+// Tone waveforms.
+//
+#define SAMD21DAC_WAVE_SINE         0
+#define SAMD21DAC_WAVE_SQUARE       1
+#define SAMD21DAC_WAVE_TRIANGLE     2
+#define SAMD21DAC_WAVE_SAWTOOTH     3
+
+//
+// The largest table, in samples, that a tone may be looped from. A tone's lowest frequency is its sample rate divided by this.
+// Two tables are held while a tone plays, so that changes take effect cleanly at a cycle boundary.
+//
+#ifndef SAMD21DAC_TONE_TABLE_MAX
+#define SAMD21DAC_TONE_TABLE_MAX    2048
+#endif
+
+//
+// The frequency error, in parts per million, that is accepted in return for a shorter tone table. Where a single cycle
+// can't reproduce the requested frequency this accurately, the table holds several cycles instead.
+//
+#ifndef SAMD21DAC_TONE_TOLERANCE
+#define SAMD21DAC_TONE_TOLERANCE    1000
+#endif
+
+//
+// Tone states.
+//
+#define SAMD21DAC_TONE_OFF          0
+#define SAMD21DAC_TONE_PLAYING      1
+#define SAMD21DAC_TONE_STOPPING     2
+
+//
+// Volume levels, and the shapes of ramps between them.
+//
+#define SAMD21DAC_VOLUME_MAX        1024    // Unity gain.
+#define SAMD21DAC_RAMP_LINEAR       0       // Gain changes linearly with time.
+#define SAMD21DAC_RAMP_EXPONENTIAL  1       // Gain changes by a constant number of dB per unit time, down to -60dB.
+
+// The number of samples between points computed on a volume ramp. The gain is interpolated linearly between them.
+#ifndef SAMD21DAC_RAMP_SEGMENT
+#define SAMD21DAC_RAMP_SEGMENT      16
+#endif
+
+//
+// Events
+//
+#define SAMD21DAC_EVT_TONE_TIMEOUT  1       // Internal: a tone's duration may have elapsed.
+#define SAMD21DAC_EVT_TONE_COMPLETE 2       // A tone has stopped.
+#define SAMD21DAC_EVT_RAMP_COMPLETE 3       // A volume ramp has reached its target level.
+#define SAMD21DAC_EVT_USER          16      // The lowest event value that may be raised on completion of a buffer given to play().
+
 using namespace codal;
 
 class SAMD21DAC : public CodalComponent, public DmaComponent, public DataSink
@@ -43,15 +167,99 @@ class SAMD21DAC : public CodalComponent, public DmaComponent, public DataSink
 private:
     SAMD21DMAC  &dmac;
     int         dmaChannel;
-    bool        active;
+    volatile bool active;
     int         dataReady;
     int         sampleRate;
+    int32_t     sampleRateError;                                // The error in the sample rate, in parts per billion.
+    int         ditherChannel;                                  // The DMA channel dithering the sample period, or -1 if none is allocated.
+    ManagedBuffer ditherPattern;                                // The sequence of timer periods that dithers the sample period.
+    int         inputFormat;
+
+    ManagedBuffer       queue[SAMD21DAC_QUEUE_SIZE];            // The buffers queued for playback, one per slot. Empty for buffers given to play().
+    uint16_t            completion[SAMD21DAC_QUEUE_SIZE];       // The event value to raise when the buffer in each slot has played, or zero for none.
+    ManagedBuffer       staging[SAMD21DAC_QUEUE_SIZE];          // Buffers holding converted samples for playback, one per slot, of SAMD21DAC_STAGING_SIZE samples.
+    DmacDescriptor      *descriptor[SAMD21DAC_QUEUE_SIZE];      // The chain of DMA descriptors, one per slot, ending at the last buffer queued.
+    volatile uint32_t   queueHead;                              // The number of buffers played to completion. The oldest queued buffer is in slot queueHead % SAMD21DAC_QUEUE_SIZE.
+    volatile uint32_t   queueTail;                              // The number of buffers queued. The next buffer is queued in slot queueTail % SAMD21DAC_QUEUE_SIZE.
+    uint32_t            samplesQueued;                          // The number of samples queued since this component was created.
+    volatile uint32_t   samplesPlayed;                          // The number of samples in buffers played to completion since this component was created.
+    uint32_t            underruns;                              // The number of times playback ran out of queued data.
+    uint32_t            lateRestarts;                           // The number of times the DMA channel stopped just before a buffer was queued.
+    int                 underrunPolicy;                         // One of the SAMD21DAC_UNDERRUN_ values.
+    bool                starved;                                // true if the queue has run dry, and no upstream data has been queued since.
+    ManagedBuffer       silence;                                // A buffer of SAMD21DAC_FILL_SIZE midscale samples.
+    DmacDescriptor      *silenceDescriptor;                     // A self linked descriptor, looping the silence buffer outside the queue.
+    volatile bool       silent;                                 // true while silence is looped in place of queued playback.
+    ManagedBuffer       ramp;                                   // A buffer of SAMD21DAC_FILL_SIZE samples, ramping from the last sample played to midscale.
+
+    ManagedBuffer       toneTable[2];                           // The tables a tone is looped from. One plays, while the other is prepared.
+    DmacDescriptor      *toneDescriptor[2];                     // Self linked descriptors, looping each tone table.
+    volatile int        toneState;                              // One of the SAMD21DAC_TONE_ values.
+    int                 toneCurrent;                            // The index of the tone table most recently started.
+    int                 toneFrequency;                          // The frequency of the tone playing, to the nearest Hz.
+    unsigned long       toneDeadline;                           // The system time, in milliseconds, at which the tone stops, or zero to play indefinitely.
+    bool                toneListening;                          // true once we are listening for SAMD21DAC_EVT_TONE_TIMEOUT.
+
+    int32_t             gain;                                   // The gain applied to the next sample queued, in Q24 format.
+    int32_t             gainStep;                               // The change in gain per sample, across the current ramp segment.
+    int32_t             gainStart;                              // The gain at the start of the current ramp.
+    int32_t             gainTarget;                             // The gain at the end of the current ramp.
+    int32_t             logStart;                               // log2 of gainStart, in Q16 format (exponential ramps only).
+    int32_t             logTarget;                              // log2 of gainTarget, in Q16 format (exponential ramps only).
+    uint32_t            rampLength;                             // The length of the current ramp, in samples.
+    uint32_t            rampRemaining;                          // The number of samples until the current ramp completes, or zero if none is in progress.
+    uint32_t            segmentRemaining;                       // The number of samples until the next point on the ramp is computed.
+    int                 rampShape;                              // One of the SAMD21DAC_RAMP_ values.
+
+    /**
+     * Adds length bytes of data to the playback queue, converting it if necessary, and restarting the DMA channel if it has stopped.
+     * The owner, if not empty, is the buffer holding the data, and is retained until it has played.
+     * If scale is true, our volume is applied to the samples. Must be called with interrupts disabled, or from the DMA interrupt.
+     */
+    int enqueue(ManagedBuffer owner, const uint8_t *data, int length, int format, bool scale);
+
+    /**
+     * Starts the stopped DMA channel from the given descriptor. The channel always starts from its own descriptor,
+     * so that is loaded with a copy of the one given. Must be called with interrupts disabled, or from the DMA interrupt.
+     */
+    void startChannel(DmacDescriptor &d);
+
+    /**
+     * Determines how far the DMAC has progressed through the playback queue. Must be called with interrupts disabled,
+     * or from the DMA interrupt.
+     *
+     * @param remaining Set to the number of samples yet to play from the buffer returned, if any.
+     *
+     * @return the queue position (counted as per queueHead) of the oldest buffer that has not finished playing,
+     * or queueTail if every queued buffer has played.
+     */
+    uint32_t findPlaying(uint32_t &remaining);
+
+    /**
+     * Converts samples to the DAC's native format, applying our volume and advancing any volume ramp in the same pass.
+     */
+    void scale(const uint8_t *in, uint16_t *out, int samples, int format);
+
+    /**
+     * Builds a table of whole cycles of the given waveform, and loops it in place of any tone already playing.
+     */
+    int startTone(int frequency, int amplitude, int waveform, const int16_t *cycle, int length, int duration);
+
+    /**
+     * Waits for the DMAC to move on to the most recently started tone table, or for a stopping tone to stop,
+     * if it has not already done so. This takes at most one cycle of the previous tone, so the calling fiber sleeps meanwhile.
+     */
+    void waitForTone();
+
+    /**
+     * Event handler, stopping the tone at the end of its duration.
+     */
+    void onToneTimeout(Event);
 
 public:
 
     // The stream component that is serving our data
     DataSource  &upstream;
-    ManagedBuffer output;
 
     /**
       * Constructor for an instance of a DAC,
@@ -67,29 +275,201 @@ public:
 	virtual int pullRequest();
 
     /**
-     * Pull down a buffer from upstream, and schedule a DMA transfer from it.
+     * Pull down a buffer from upstream, and queue it for playback.
      */
     int pull();
 
     void setValue(int value);
     int getValue();
-    int play(const uint16_t *buffer, int length);
 
     /**
-     * Change the DAC playback sample rate to the given frequency.
-     * n.b. Only sample periods that are a multiple of 125nS are supported.
-     * Frequencies mathcing other sample periods will be rounded down to the next lowest supported frequency.
+     * Queues the given samples for playback, after any buffers already queued. The samples are played in place where
+     * possible, so may be held in flash, and must remain valid until they have played. Completion can be detected by
+     * requesting an event, or by comparing getQueuedPosition() before this call with getPlaybackPosition().
+     * If the volume is below SAMD21DAC_VOLUME_MAX, the samples are scaled into a staging buffer as they are queued instead.
      *
-     * @param frequency The new sample playback frequency.
+     * Each buffer is played as a single DMA block, so may hold at most 65535 samples, or SAMD21DAC_STAGING_SIZE if it
+     * must be scaled into a staging buffer. Buffers play back to back, but a slot in the queue is only freed once the
+     * completion interrupt for its buffer has been handled. For playback without gaps, each buffer should therefore hold
+     * at least SAMD21DAC_FILL_SIZE samples (1.5ms at 44.1kHz), so that the next is queued before those already queued
+     * have played.
+     *
+     * @param buffer The samples to play, in SAMD21DAC_FORMAT_NATIVE format.
+     * @param length The number of samples, between 1 and 65535.
+     * @param event The value of an event to raise from this component once the samples have played, or zero for none.
+     * Values below SAMD21DAC_EVT_USER are reserved.
+     *
+     * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the length is out of range or the event value is reserved,
+     * DEVICE_NO_RESOURCES if the playback queue is full or the buffer is too long to stage, or DEVICE_BUSY if a tone is playing.
+     */
+    int play(const uint16_t *buffer, int length, uint16_t event = 0);
+
+    /**
+     * Determines how many buffers are queued for playback, including the one playing.
+     *
+     * @return the number of buffers queued, between zero and SAMD21DAC_QUEUE_SIZE.
+     */
+    int getQueueLength();
+
+    /**
+     * Determines the playback position, as the number of samples played since this component was created.
+     * This includes ramps played on underrun, but not silence or tones.
+     *
+     * @return the number of samples played.
+     */
+    uint32_t getPlaybackPosition();
+
+    /**
+     * Determines the playback position at which the next buffer queued will start to play, assuming no underrun.
+     *
+     * @return the number of samples queued since this component was created.
+     */
+    uint32_t getQueuedPosition();
+
+    /**
+     * Declares the format of samples provided by our upstream component.
+     * Samples are converted to the DAC's native format in a single pass as they are queued, so no separate
+     * conversion stage is needed. The default, SAMD21DAC_FORMAT_NATIVE, plays buffers directly without conversion.
+     *
+     * @param format One of SAMD21DAC_FORMAT_NATIVE, SAMD21DAC_FORMAT_S16, SAMD21DAC_FORMAT_U16,
+     * SAMD21DAC_FORMAT_S8 or SAMD21DAC_FORMAT_U8.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the format is not recognised.
+     */
+    int setInputFormat(int format);
+
+    /**
+     * Determines the format of samples expected from our upstream component.
+     *
+     * @return One of the SAMD21DAC_FORMAT_ values.
+     */
+    int getInputFormat();
+
+    /**
+     * Changes the volume of queued playback, either immediately or as a smooth ramp over the given time.
+     * The gain is applied to each sample as it is converted into a staging buffer, so ramps are sample accurate and
+     * need no extra pass over the data. As samples are converted when queued, changes are heard after any buffers
+     * already queued have played. Tones are not affected.
+     *
+     * A SAMD21DAC_EVT_RAMP_COMPLETE event is raised when the last sample of the ramp is queued.
+     * Any ramp in progress is replaced, starting from the current gain, so ramps may be changed without clicks.
+     *
+     * @param level The target level, in the range 0..SAMD21DAC_VOLUME_MAX. SAMD21DAC_VOLUME_MAX plays samples unaltered.
+     * @param duration The length of the ramp, in milliseconds, or zero to change the volume immediately.
+     * @param shape SAMD21DAC_RAMP_LINEAR or SAMD21DAC_RAMP_EXPONENTIAL. Exponential ramps sound more even to the
+     * ear, but start from or end at -60dB where the level is zero, before stepping to silence.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if any parameter is out of range.
+     */
+    int setVolume(int level, int duration = 0, int shape = SAMD21DAC_RAMP_LINEAR);
+
+    /**
+     * Determines the volume of queued playback, which may be part way through a ramp.
+     *
+     * @return the level applied to the next sample queued, in the range 0..SAMD21DAC_VOLUME_MAX.
+     */
+    int getVolume();
+
+    /**
+     * Selects what is played when upstream data does not arrive in time, and the playback queue runs dry.
+     * Silence is looped by the DMAC outside the playback queue, so it raises no interrupts, and does not prevent
+     * a tone from starting. If silence is already playing, it continues until data is queued.
+     *
+     * @param policy One of SAMD21DAC_UNDERRUN_HOLD, SAMD21DAC_UNDERRUN_RAMP or SAMD21DAC_UNDERRUN_SILENCE.
+     *
+     * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the policy is not recognised, or DEVICE_NO_RESOURCES
+     * if a DMA descriptor is not available to loop silence.
+     */
+    int setUnderrunPolicy(int policy);
+
+    /**
+     * Determines how often the DMA channel stopped between buffers because a buffer was queued a moment too late,
+     * after the DMAC had already finished the previous one. Each of these is also counted as an underrun.
+     *
+     * @return the number of late restarts since this component was created.
+     */
+    uint32_t getLateRestartCount();
+
+    /**
+     * Determines how often playback has run out of queued data. Each period of starvation is counted once,
+     * regardless of how long it lasts, or what is played meanwhile.
+     *
+     * @return the number of underruns since this component was created.
+     */
+    uint32_t getUnderrunCount();
+
+    /**
+     * Plays a continuous tone, looped from a table in memory by the DMA controller, so that the CPU is not involved once
+     * the tone has started. The table holds a whole number of cycles at the current sample rate, so the frequency played
+     * may differ very slightly from that requested (see getToneFrequency()). If a tone is already playing, the new one
+     * follows on at the end of its current cycle, so frequency, amplitude and duration may be changed without glitches.
+     *
+     * Tones take priority over queued playback: upstream data is left waiting until the tone stops, and play() is refused.
+     * A SAMD21DAC_EVT_TONE_COMPLETE event is raised when the tone stops.
+     *
+     * @param frequency The frequency of the tone, in Hz. At most half the sample rate, and at least the sample rate / SAMD21DAC_TONE_TABLE_MAX.
+     * @param amplitude The peak amplitude of the tone, in the range 0..511.
+     * @param waveform One of SAMD21DAC_WAVE_SINE, SAMD21DAC_WAVE_SQUARE, SAMD21DAC_WAVE_TRIANGLE or SAMD21DAC_WAVE_SAWTOOTH.
+     * @param duration The time in milliseconds to play the tone for, or zero to play until stopTone() is called.
+     * The tone stops at the first cycle boundary after this time has elapsed.
+     *
+     * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if any parameter is out of range, DEVICE_BUSY if
+     * queued buffers are playing, or DEVICE_NO_RESOURCES if DMA descriptors or memory for the table are not available.
+     */
+    int playTone(int frequency, int amplitude, int waveform = SAMD21DAC_WAVE_SINE, int duration = 0);
+
+    /**
+     * Plays a continuous tone of an arbitrary waveform, as per playTone(). The given cycle is resampled into the tone table,
+     * so it need not match the tone's frequency, and need not be retained once this returns.
+     *
+     * @param cycle A single cycle of the waveform, as signed 16 bit samples.
+     * @param length The number of samples in the cycle.
+     * @param frequency The frequency of the tone, in Hz.
+     * @param amplitude The peak amplitude of the tone, in the range 0..511, corresponding to a full scale sample.
+     * @param duration The time in milliseconds to play the tone for, or zero to play until stopTone() is called.
+     *
+     * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if any parameter is out of range, DEVICE_BUSY if
+     * queued buffers are playing, or DEVICE_NO_RESOURCES if DMA descriptors or memory for the table are not available.
+     */
+    int playWaveform(const int16_t *cycle, int length, int frequency, int amplitude, int duration = 0);
+
+    /**
+     * Stops the tone playing, at the end of its current cycle. Queued playback then resumes.
+     *
+     * @return DEVICE_OK.
+     */
+    int stopTone();
+
+    /**
+     * Determines the frequency of the tone playing, which may differ slightly from that requested.
+     *
+     * @return the frequency in Hz, rounded to the nearest Hz, or zero if no tone is playing.
+     */
+    int getToneFrequency();
+
+    /**
+     * Determines the DAC playback sample rate.
+     *
+     * @return the sample rate achieved, rounded to the nearest Hz.
      */
     int getSampleRate();
 
+    /**
+     * Determines how far the sample rate achieved differs from that requested, relative to the system clocks.
+     *
+     * @return the error in parts per million, rounded to the nearest ppm. Positive if the rate is fast.
+     */
+    int getSampleRateError();
+
     /**
      * Change the DAC playback sample rate to the given frequency.
-     * n.b. Only sample periods that are a multiple of 125nS are supported.
-     * Frequencies mathcing other sample periods will be rounded to the next highest supported frequency.
+     * The sample clock is planned by SAMD21ClockPlanner, choosing between the main clock, the peripheral clock, and
+     * (if SAMD21DAC_DPLL_REFERENCE is set) the DPLL. Where the rate is not an exact division of any of these, the
+     * sample period is dithered by a second DMA channel, so that the long term average rate is exact, or as close as possible.
      *
      * @param frequency The new sample playback frequency.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the rate can't be generated.
      */
     int setSampleRate(int frequency);
 
@@ -33,6 +33,18 @@ DEALINGS IN THE SOFTWARE.
 #define DMA_DESCRIPTOR_ALIGNMENT 16 // SAMD21 Datasheet 20.8.15 and 20.8.16
 #define DMA_DESCRIPTOR_COUNT 4
 
+//
+// The number of additional descriptors available to extend channels into linked or circular descriptor chains.
+// The default is exactly enough for a SAMD21PDM ring (SAMD21_PDM_BUFFER_COUNT - 1 = 3), a SAMD21DAC queue
+// (SAMD21DAC_QUEUE_SIZE = 3), the SAMD21DAC tone tables (2) and the SAMD21DAC silence loop (1). Increase it if
+// those are enlarged, or more components use linked descriptors. At most 32 are supported.
+//
+#ifndef DMA_LINKED_DESCRIPTOR_COUNT
+#define DMA_LINKED_DESCRIPTOR_COUNT 9
+#endif
+
+static_assert(DMA_LINKED_DESCRIPTOR_COUNT <= 32, "DMA_LINKED_DESCRIPTOR_COUNT must fit the 32 bit allocation mask");
+
 using namespace codal;
 
 class DmaComponent
@@ -45,9 +57,10 @@ class DmaComponent
 class SAMD21DMAC
 {
     // descriptors have to be 128 bit aligned - we allocate 16 more bytes, and set descriptors
-    // at the right offset in descriptorsBuffer
-    uint8_t descriptorsBuffer[sizeof(DmacDescriptor) * (DMA_DESCRIPTOR_COUNT * 2) + DMA_DESCRIPTOR_ALIGNMENT];
+    // at the right offset in descriptorsBuffer. Linked descriptors follow the writeback and base descriptors.
+    uint8_t descriptorsBuffer[sizeof(DmacDescriptor) * (DMA_DESCRIPTOR_COUNT * 2 + DMA_LINKED_DESCRIPTOR_COUNT) + DMA_DESCRIPTOR_ALIGNMENT];
     DmacDescriptor *descriptors;
+    uint32_t linkedDescriptorsAllocated;
 
 public:
 
@@ -62,6 +75,14 @@ public:
      */
     DmacDescriptor& getDescriptor(int channel);
 
+    /**
+     * Provides the write-back descriptor for the given channel number. While the channel is busy, this holds a copy of
+     * the descriptor currently being processed. Its DESCADDR determines which descriptor is fetched when the current block
+     * completes, so it may be updated to redirect an active channel at the next block boundary.
+     * @return the write-back descriptor, matching a previously allocated channel.
+     */
+    DmacDescriptor& getWriteBackDescriptor(int channel);
+
     /**
      * Allocates an unused DMA channel, if one is available.
      * @return a valid channel descriptor in the range 1..DMA_DESCRIPTOR_COUNT, or DEVICE_NO_RESOURCES otherwise.
@@ -75,6 +96,32 @@ public:
      */
     int freeChannel(int channel);
 
+    /**
+     * Allocates a descriptor that can be added to a channel's descriptor chain, using linkDescriptor().
+     * @return a zeroed, suitably aligned descriptor, or NULL if none are available.
+     */
+    DmacDescriptor* allocateDescriptor();
+
+    /**
+     * Release a previously allocated linked descriptor.
+     * @param descriptor the descriptor to free.
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the descriptor was not allocated by allocateDescriptor().
+     */
+    int freeDescriptor(DmacDescriptor *descriptor);
+
+    /**
+     * Links a descriptor to its successor, such that the DMAC moves directly on to the next block transfer
+     * when this one completes, without any CPU intervention.
+     * A block complete interrupt is raised at the end of each linked block. If it is not serviced before the next block
+     * completes, the interrupts coalesce, so DmaComponent::dmaTransferComplete() may be called once for several blocks.
+     * Use the write-back descriptor (see getWriteBackDescriptor()) to determine which block the channel is processing.
+     *
+     * @param descriptor the descriptor to update.
+     * @param next the descriptor to follow it, or NULL to end the transfer after this block.
+     * This may be a channel's own descriptor (see getDescriptor()), to form a circular chain.
+     */
+    void linkDescriptor(DmacDescriptor &descriptor, DmacDescriptor *next);
+
     /**
      * Disables all confgures DMA activity.
      * Typically required before configuring DMA descriptors and DMA channels.
@@ -26,29 +26,141 @@ DEALINGS IN THE SOFTWARE.
 #include "Pin.h"
 #include "SAMD21DMAC.h"
 #include "DataStream.h"
+#include "CICDecimator.h"
+#include "SincDecimator.h"
 
 #ifndef SAMD21PDM_H
 #define SAMD21PDM_H
 
-#define SAMD21_PDM_DECIMATION    64
-
 //
-// RAW buffer size for PDM data from a MEMS microphone, in bytes.
-// n.b. this is required to be word aligned (multiple of 4 bytes),
-// but TWO buffers of this size are created in a double buffer configuration.
+// The default RAW buffer size for PDM data from a MEMS microphone, in bytes.
+// SAMD21_PDM_BUFFER_COUNT buffers of this size are created in a ring configuration.
+// Smaller buffers reduce latency, larger ones reduce the interrupt rate.
 //
 #ifndef SAMD21_PDM_BUFFER_SIZE
 #define SAMD21_PDM_BUFFER_SIZE         256
 #endif
 
-// The number of buffers to cycle through before reporting data back to high layers
-// (used to avoid providing unbalanced samples at the start of use).
-#define SAMD21_START_UP_DELAY          3
+// RAW buffers must hold a whole number of PCM samples at the largest decimation ratio (256 bits per channel).
+#define SAMD21_PDM_BUFFER_ALIGNMENT    64
+#define SAMD21_PDM_BUFFER_SIZE_MAX     16384
+
+//
+// The default PCM output buffer size, in bytes.
+// Small buffers suit low latency processing such as keyword spotting, and large buffers suit bulk recording.
+//
+#ifndef SAMD21_PDM_OUTPUT_SIZE
+#define SAMD21_PDM_OUTPUT_SIZE         512
+#endif
+
+// PCM output buffers must hold a whole number of stereo sample pairs, in any output format.
+#define SAMD21_PDM_OUTPUT_ALIGNMENT    8
+#define SAMD21_PDM_OUTPUT_SIZE_MAX     16384
+
+//
+// The number of RAW buffers in the DMA ring. The buffers are filled continuously, using a circular chain of DMA descriptors.
+// One buffer is always being filled by DMA, so up to (SAMD21_PDM_BUFFER_COUNT - 1) buffers can await decimation before data is lost.
+// (SAMD21_PDM_BUFFER_COUNT - 1) linked descriptors are required from the DMA controller.
+//
+#ifndef SAMD21_PDM_BUFFER_COUNT
+#define SAMD21_PDM_BUFFER_COUNT        4
+#endif
+
+//
+// The default number of PCM output buffers held in the pool of each SAMD21PDM instance.
+// One buffer is filled while the others are held downstream, so at least two are required.
+//
+#ifndef SAMD21_PDM_POOL_SIZE
+#define SAMD21_PDM_POOL_SIZE           3
+#endif
+
+//
+// The default limit on the time spent decimating within a single DMA interrupt, in microseconds,
+// when decimation is performed in interrupt context. See setInterruptDecimation().
+//
+#ifndef SAMD21_PDM_INTERRUPT_BUDGET
+#define SAMD21_PDM_INTERRUPT_BUDGET    250
+#endif
+
+//
+// Settle detection. After the microphone is enabled, or the decimation filter is changed, samples are discarded until the
+// output converges: the mean (DC) level of consecutive windows of 2^SAMD21_PDM_SETTLE_WINDOW_SHIFT samples must agree
+// to within SAMD21_PDM_SETTLE_DRIFT, and the RMS level of the window about that mean must be below SAMD21_PDM_SETTLE_LEVEL.
+// Output is considered valid regardless after SAMD21_PDM_SETTLE_TIMEOUT milliseconds.
+//
+#define SAMD21_PDM_SETTLE_WINDOW_SHIFT 6
+
+#ifndef SAMD21_PDM_SETTLE_DRIFT
+#define SAMD21_PDM_SETTLE_DRIFT        64
+#endif
+
+#ifndef SAMD21_PDM_SETTLE_LEVEL
+#define SAMD21_PDM_SETTLE_LEVEL        8192
+#endif
+
+#ifndef SAMD21_PDM_SETTLE_TIMEOUT
+#define SAMD21_PDM_SETTLE_TIMEOUT      70
+#endif
+
+//
+// The unity setting of the digital gain stage (gain is expressed in 1/256ths).
+//
+#define SAMD21_PDM_UNITY_GAIN           256
+
+//
+// Channel modes. Slot 0 (the low half of each I2S word) is the left channel.
+//
+#define SAMD21_PDM_MONO                 0       // Left channel only.
+#define SAMD21_PDM_STEREO_INTERLEAVED   1       // Left and right samples alternate in each output buffer.
+#define SAMD21_PDM_STEREO_PLANAR        2       // Left samples fill the first half of each output buffer, right samples the second.
+
+//
+// Output sample formats. Samples are written directly in the selected format as they are decimated.
+//
+#define SAMD21_PDM_FORMAT_S16           0       // Signed 16 bit linear.
+#define SAMD21_PDM_FORMAT_S8            1       // Signed 8 bit linear.
+#define SAMD21_PDM_FORMAT_U8            2       // Unsigned 8 bit linear, centred on 128.
+#define SAMD21_PDM_FORMAT_ULAW          3       // 8 bit G.711 mu-law.
+#define SAMD21_PDM_FORMAT_Q31           4       // Signed 32 bit, retaining 8 bits of precision below the 16 bit range from the gain stage.
+
+//
+// Voice activity detection modes.
+//
+#define SAMD21_PDM_VAD_OFF              0       // No voice activity detection.
+#define SAMD21_PDM_VAD_TAG              1       // All buffers are passed downstream, and speech events are raised.
+#define SAMD21_PDM_VAD_GATE             2       // Only buffers containing speech are passed downstream, and speech events are raised.
+
+// Default RMS level (in 16 bit sample units) above which a buffer may be considered to contain speech.
+#ifndef SAMD21_PDM_VAD_THRESHOLD
+#define SAMD21_PDM_VAD_THRESHOLD        300
+#endif
+
+// Default number of quiet buffers after the last voiced buffer before speech is considered to have ended.
+#ifndef SAMD21_PDM_VAD_HANGOVER
+#define SAMD21_PDM_VAD_HANGOVER         8
+#endif
+
+// Buffers are only considered voiced if fewer than 1 in SAMD21_PDM_VAD_ZCR_DIVISOR samples is a zero crossing.
+// This rejects broadband noise, which crosses zero far more often than speech.
+#ifndef SAMD21_PDM_VAD_ZCR_DIVISOR
+#define SAMD21_PDM_VAD_ZCR_DIVISOR      3
+#endif
+
+//
+// Sound level meter integration windows, in milliseconds (as per the IEC 61672 fast and slow time weightings).
+//
+#define SAMD21_PDM_LEVEL_OFF            0
+#define SAMD21_PDM_LEVEL_FAST           125
+#define SAMD21_PDM_LEVEL_SLOW           1000
 
 //
 // Event codes
 //
 #define SAMD21_PDM_DATA_READY           1
+#define SAMD21_PDM_SPEECH_START         2
+#define SAMD21_PDM_SPEECH_END           3
+#define SAMD21_PDM_LEVEL_THRESHOLD_HIGH 4
+#define SAMD21_PDM_LEVEL_THRESHOLD_LOW  5
 
 using namespace codal;
 
@@ -57,21 +169,67 @@ class SAMD21PDM : public CodalComponent, public DmaComponent, public DataSource
 
 private:
     bool            enabled;                                // Determines if this component is actively receiving data.
-    int             invalid;                                // Detemrines if this component has received sufficient data to provide valid output.
+    uint32_t        invalid;                                // The maximum number of further samples to discard while the output settles, or zero once it is valid.
+    int32_t         settleSum;                              // The sum of the (left channel) samples in the current settle window.
+    uint32_t        settleEnergy;                           // The mean square of the (left channel) samples in the current settle window.
+    int             settleCount;                            // The number of samples in the current settle window.
+    int             settleWindows;                          // The number of settle windows completed since settling began.
+    int32_t         settleMean;                             // The mean sample value of the previous settle window.
+    uint32_t        settleElapsed;                          // The number of samples discarded since settling began.
+    uint32_t        settleTime;                             // The number of samples discarded before the output last became valid.
 	ManagedBuffer   buffer;                                 // A reference counted stream buffer used to hold PCM sample data.
+    BufferData      **pool;                                 // Preallocated PCM output buffers, each holding a permanent reference from this component.
+    int             poolSize;                               // The number of buffers in the pool.
+    uint16_t        poolIdleReference;                      // The reference count of a pooled buffer that is not in use elsewhere.
+    uint32_t        poolExhausted;                          // The number of times an output buffer was dropped as the pool had no free buffers.
     uint32_t        outputBufferSize;                       // The size of our output buffer.
 	  uint32_t        sampleRate;                             // The PCM output target sample rate (in bps).
-    int16_t         *out;                                   // Write pointer into the output PCM buffer;
+    uint8_t         *out;                                   // Write pointer into the output PCM buffer;
+    int             outputFormat;                           // The format of each output sample, one of the SAMD21_PDM_FORMAT_ values.
+    int             sampleSize;                             // The size of each output sample, in bytes.
 
-    uint8_t         rawPDM1[SAMD21_PDM_BUFFER_SIZE];        // A statically alloctaed buffer into which PDM data is transferred via DMA.
-    uint8_t         rawPDM2[SAMD21_PDM_BUFFER_SIZE];        // A statically alloctaed buffer into which PDM data is transferred via DMA.
-    uint8_t *       pdmDataBuffer;                          // pointer to the PDM buffer that's ready for processing
-    uint8_t *       pdmReceiveBuffer;                       // pointer ot the PDM buffer that's ready for receving data from the PDM hardware.
+    uint8_t         *rawPDM;                                // A ring of SAMD21_PDM_BUFFER_COUNT buffers into which PDM data is transferred via DMA.
+    uint32_t        rawBufferSize;                          // The size of each RAW buffer in the ring, in bytes.
+    DmacDescriptor  *rawDescriptor[SAMD21_PDM_BUFFER_COUNT];// The circular chain of DMA descriptors, one per buffer in the ring.
+    volatile uint32_t rawWritten;                           // The number of buffers filled by DMA. Only updated by the DMA interrupt.
+    volatile uint32_t rawRead;                              // The number of buffers processed. Only updated by the decimator.
+    uint32_t        overruns;                               // The number of RAW buffers lost, or overwritten while being decimated, because the ring was full.
+
+    bool            interruptDecimation;                    // Determines if decimation is performed in the DMA interrupt, rather than via the message bus.
+    uint32_t        interruptBudget;                        // The maximum time to spend decimating within a single interrupt, in microseconds.
+    uint32_t        interruptDuration;                      // The time taken by the most recent interrupt, in microseconds.
+    uint32_t        interruptDurationMax;                   // The longest time taken by any interrupt, in microseconds.
 
 	   uint32_t        clockRate;                              // The bit rate at which PDM data is received (in bps).                            // The number of pdmSampled used so far in the generation of a PCM sample.
 
-    int32_t        runningSum;                             //SINC filter parameters
-    const uint16_t        *sincPtr;
+    int             decimation;                             // The number of PDM samples per PCM sample.
+    int             filterStages;                           // The number of CIC stages in use, or zero if the windowed sinc filter is in use.
+    CICDecimator    cic[2];                                 // The CIC decimation filters for the left and right channels, used when filterStages is non-zero.
+    int             channelMode;                            // One of SAMD21_PDM_MONO, SAMD21_PDM_STEREO_INTERLEAVED or SAMD21_PDM_STEREO_PLANAR.
+
+    int             highPassShift;                          // The time constant of the DC blocking filter, as a power of two samples, or zero if disabled.
+    int32_t         dcLevel[2];                             // The DC level tracked by the high pass filter for each channel, scaled by 2^highPassShift.
+    int             gain;                                   // The digital gain applied to each sample, in 1/256ths.
+
+    uint64_t        blockEnergy;                            // The sum of the squares of the (left channel) samples in the current output buffer.
+    int             blockCrossings;                         // The number of zero crossings in the current output buffer.
+    int             blockSamples;                           // The number of (left channel) samples in the current output buffer.
+    int32_t         blockPeak;                              // The largest absolute (left channel) sample in the current output buffer.
+    int32_t         lastSample;                             // The previous (left channel) sample, used to detect zero crossings.
+
+    int             vadMode;                                // One of SAMD21_PDM_VAD_OFF, SAMD21_PDM_VAD_TAG or SAMD21_PDM_VAD_GATE.
+    uint32_t        vadThreshold;                           // The mean square energy above which a buffer may be considered voiced.
+    int             vadHangover;                            // The number of quiet buffers before speech is considered to have ended.
+    int             vadCountdown;                           // The number of quiet buffers remaining before speech is considered to have ended.
+    bool            speechActive;                           // true if speech is currently detected.
+
+    int             levelWindow;                            // The integration time of the sound level meter in milliseconds, or zero if disabled.
+    uint32_t        levelAlpha;                             // The weight given to each new output buffer by the sound level meter, in 1/65536ths.
+    uint32_t        levelEnergy;                            // The exponentially weighted mean square sample value.
+    uint32_t        levelPeak;                              // The exponentially decaying peak absolute sample value.
+    uint32_t        levelHigh;                              // The mean square energy above which a SAMD21_PDM_LEVEL_THRESHOLD_HIGH event is raised, or zero if disabled.
+    uint32_t        levelLow;                               // The mean square energy below which a SAMD21_PDM_LEVEL_THRESHOLD_LOW event is raised, or zero if disabled.
+    bool            levelLoud;                              // true if the sound level last crossed the high threshold, false if it last crossed the low threshold.
 
     int             dmaChannel;                             // The DMA channel used by this component
     SAMD21DMAC      &dmac;                                  // The DMA controller used by this component
@@ -86,10 +244,17 @@ public:
       * @param sd The pin the PDM data input is connected to.
       * @param sck The pin the PDM clock is conected to.
       * @param dma The DMA controller to use for data transfer.
-      * @param sampleRate the rate at which samples are generated in the output buffer (in Hz)
+      * @param sampleRate the rate at which samples are generated in the output buffer (in Hz).
+      * One of 8000, 16000, 22050, 32000 or 44100. Other values are rounded to the nearest of these.
+      * Defaults to 22050 Hz, which earlier versions requested as 22000 Hz.
       * @param id The id to use for the message bus when transmitting events.
+      * @param poolSize The number of PCM output buffers to preallocate (minimum 2).
+      * @param rawBufferSize The size of each RAW PDM buffer in the DMA ring, in bytes.
+      * Rounded up to a multiple of SAMD21_PDM_BUFFER_ALIGNMENT, and limited to SAMD21_PDM_BUFFER_SIZE_MAX.
+      * @param outputBufferSize The size of each PCM output buffer, in bytes.
+      * Rounded up to a multiple of SAMD21_PDM_OUTPUT_ALIGNMENT, and limited to SAMD21_PDM_OUTPUT_SIZE_MAX.
       */
-    SAMD21PDM(Pin &sd, Pin &sck, SAMD21DMAC &dma, int sampleRate=22000, uint16_t id = DEVICE_ID_SYSTEM_MICROPHONE);
+    SAMD21PDM(Pin &sd, Pin &sck, SAMD21DMAC &dma, int sampleRate=22050, uint16_t id = DEVICE_ID_SYSTEM_MICROPHONE, int poolSize = SAMD21_PDM_POOL_SIZE, int rawBufferSize = SAMD21_PDM_BUFFER_SIZE, int outputBufferSize = SAMD21_PDM_OUTPUT_SIZE);
 
 	/**
 	 * Provide the next available ManagedBuffer to our downstream caller, if available.
@@ -106,6 +271,228 @@ public:
      */
     virtual void dmaTransferComplete();
 
+    /**
+     * Selects the decimation filter used to generate PCM samples from PDM data.
+     * The output sample rate scales inversely with the decimation ratio.
+     *
+     * @param decimation The number of PDM samples per PCM sample, a power of two between 16 and 256.
+     * @param stages The number of CIC stages to use (1..CIC_DECIMATOR_MAX_STAGES), or zero to use the windowed sinc filter.
+     * The windowed sinc filter only supports a decimation of SINC_DECIMATOR_TAPS.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the configuration is not supported.
+     */
+    int setDecimation(int decimation, int stages = CIC_DECIMATOR_MAX_STAGES);
+
+    /**
+     * Selects the format of each sample in the output buffers. Samples are converted as they are decimated,
+     * so no additional pass over the data is required. The output buffer size is unchanged, so 8 bit formats
+     * hold twice as many samples per buffer (or the same number in half the memory), and Q31 half as many.
+     *
+     * @param format One of SAMD21_PDM_FORMAT_S16, SAMD21_PDM_FORMAT_S8, SAMD21_PDM_FORMAT_U8,
+     * SAMD21_PDM_FORMAT_ULAW or SAMD21_PDM_FORMAT_Q31.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the format is not recognised.
+     */
+    int setOutputFormat(int format);
+
+    /**
+     * Determines the format of each sample in the output buffers.
+     *
+     * @return One of the SAMD21_PDM_FORMAT_ values.
+     */
+    int getOutputFormat();
+
+    /**
+     * Selects whether one or both microphones are captured, and how their samples are laid out in each output buffer.
+     * Both channels are decimated in a single pass over the received PDM data.
+     *
+     * @param mode One of SAMD21_PDM_MONO, SAMD21_PDM_STEREO_INTERLEAVED or SAMD21_PDM_STEREO_PLANAR.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the mode is not recognised.
+     */
+    int setChannelMode(int mode);
+
+    /**
+     * Configures the DC blocking high pass filter applied to each sample as it is decimated.
+     * The -3dB point of the filter is approximately sampleRate / (2 * pi * 2^shift).
+     *
+     * @param shift The time constant of the filter, as a power of two samples (4..12), or zero to disable the filter.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the time constant is out of range.
+     */
+    int setHighPassFilter(int shift);
+
+    /**
+     * Sets the digital gain applied to each sample as it is decimated, after high pass filtering.
+     * Samples that exceed the 16 bit output range are saturated.
+     *
+     * @param gain The gain, in 1/256ths (SAMD21_PDM_UNITY_GAIN is unity). Up to 64x (16384) is supported.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the gain is out of range.
+     */
+    int setGain(int gain);
+
+    /**
+     * Configures voice activity detection. The short term energy and zero crossing rate of the left channel are
+     * computed as samples are decimated, and each completed output buffer is classified as voiced or quiet.
+     * SAMD21_PDM_SPEECH_START and SAMD21_PDM_SPEECH_END events are raised as speech starts and ends.
+     * For best results, enable the high pass filter to remove any DC offset. See setHighPassFilter().
+     *
+     * @param mode One of SAMD21_PDM_VAD_OFF, SAMD21_PDM_VAD_TAG or SAMD21_PDM_VAD_GATE.
+     * In SAMD21_PDM_VAD_GATE mode, buffers are only passed downstream while speech is active.
+     * @param threshold The RMS level (in 16 bit sample units) above which a buffer may be considered voiced.
+     * @param hangover The number of quiet buffers after the last voiced buffer before speech is considered to have ended.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the mode is not recognised.
+     */
+    int setVoiceActivityDetection(int mode, int threshold = SAMD21_PDM_VAD_THRESHOLD, int hangover = SAMD21_PDM_VAD_HANGOVER);
+
+    /**
+     * Determines if speech is currently detected, when voice activity detection is enabled.
+     *
+     * @return true if speech is active, false otherwise.
+     */
+    bool isSpeechActive();
+
+    /**
+     * Configures the sound level meter. The energy and peak value of the left channel are accumulated as samples are
+     * decimated, and integrated over time with an exponential weighting.
+     *
+     * @param window The integration time in milliseconds, typically SAMD21_PDM_LEVEL_FAST or SAMD21_PDM_LEVEL_SLOW,
+     * or SAMD21_PDM_LEVEL_OFF to disable the sound level meter.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the window is negative.
+     */
+    int setSoundLevelWindow(int window);
+
+    /**
+     * Configures the sound levels at which events are raised. A SAMD21_PDM_LEVEL_THRESHOLD_HIGH event is raised when
+     * the sound level rises above the high threshold, and a SAMD21_PDM_LEVEL_THRESHOLD_LOW event is raised when it then
+     * falls below the low threshold.
+     *
+     * @param low The RMS level (in 16 bit sample units) below which the sound is considered quiet, or zero to disable.
+     * @param high The RMS level (in 16 bit sample units) above which the sound is considered loud, or zero to disable.
+     *
+     * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the thresholds are out of range.
+     */
+    int setSoundLevelThreshold(int low, int high);
+
+    /**
+     * Determines the current RMS sound level, as integrated by the sound level meter.
+     *
+     * @return the RMS level in 16 bit sample units (0..32767).
+     */
+    int getSoundLevel();
+
+    /**
+     * Determines the current peak sound level. The peak level decays at the rate set by setSoundLevelWindow().
+     *
+     * @return the peak absolute sample value in 16 bit sample units (0..32767).
+     */
+    int getPeakLevel();
+
+    /**
+     * Determines the current RMS sound level, relative to a full scale square wave.
+     *
+     * @return the sound level in dBFS, between -96 (silence) and 0.
+     */
+    int getSoundLevelDb();
+
+    /**
+     * Determines the rate at which PCM samples are generated.
+     *
+     * @return the output sample rate, in Hz.
+     */
+    int getSampleRate();
+
+    /**
+     * Determines the rate at which PDM data is received from the microphone. The PDM clock is derived from 48MHz
+     * by an integer divisor, so the output sample rate is rarely a whole number of Hz. It is (to within 1ppm)
+     * getClockRate() / getDecimation(), which can be used to configure a PCMResampler for an exact output rate.
+     *
+     * @return the PDM clock rate, in Hz.
+     */
+    uint32_t getClockRate();
+
+    /**
+     * Determines the number of PDM samples per PCM sample of the current decimation filter.
+     *
+     * @return the decimation ratio.
+     */
+    int getDecimation();
+
+    /**
+     * Determines how often a complete PCM buffer was dropped because every buffer in the pool was still held downstream.
+     *
+     * @return the number of buffers dropped since this component was created.
+     */
+    uint32_t getPoolExhaustedCount();
+
+    /**
+     * Determines how many RAW PDM buffers have been dropped because decimation fell behind and the DMA ring was full.
+     * Each dropped buffer represents a gap of (getRawBufferSize() * 4 / decimation) samples in the output.
+     *
+     * @return the number of buffers dropped since this component was created.
+     */
+    uint32_t getOverrunCount();
+
+    /**
+     * Determines the size of each RAW PDM buffer in the DMA ring.
+     *
+     * @return the RAW buffer size, in bytes.
+     */
+    int getRawBufferSize();
+
+    /**
+     * Determines the size of each PCM output buffer.
+     *
+     * @return the output buffer size, in bytes.
+     */
+    int getOutputBufferSize();
+
+    /**
+     * Determines the worst case delay between a sound reaching the microphone and the PCM sample representing it
+     * being passed downstream. This is the time taken to fill one RAW buffer and one output buffer, and excludes
+     * any decimation delay if the CPU falls behind.
+     *
+     * @return the latency, in microseconds.
+     */
+    int getLatency();
+
+    /**
+     * Determines how long the output took to settle after the microphone was last enabled, or the decimation
+     * filter last changed. Samples are discarded until the output converges, up to SAMD21_PDM_SETTLE_TIMEOUT.
+     *
+     * @return the settling time, in microseconds.
+     */
+    int getSettleTime();
+
+    /**
+     * Selects whether PDM data is decimated directly in the DMA interrupt, or deferred to the message bus (the default).
+     * Decimating in interrupt context minimises the latency between the microphone and downstream components,
+     * which are then also called in interrupt context. If decimation falls behind, any buffers remaining when the
+     * budget is exhausted are processed by the next interrupt.
+     *
+     * @param enable true to decimate in interrupt context, false to decimate via the message bus.
+     * @param budget The maximum time to spend decimating within a single interrupt, in microseconds.
+     * At least one buffer is always processed.
+     */
+    void setInterruptDecimation(bool enable, int budget = SAMD21_PDM_INTERRUPT_BUDGET);
+
+    /**
+     * Determines the time spent in the most recent DMA interrupt, when decimating in interrupt context.
+     *
+     * @return the duration of the last interrupt, in microseconds.
+     */
+    int getInterruptDuration();
+
+    /**
+     * Determines the longest time spent in any DMA interrupt, when decimating in interrupt context.
+     *
+     * @return the longest interrupt duration observed, in microseconds.
+     */
+    int getMaxInterruptDuration();
+
     /**
      * Enable this component
      */
@@ -119,7 +506,17 @@ public:
 private:
 
     void startDMA();
+    ManagedBuffer allocateBuffer();
+    int getBufferSamples();
+    void store(uint8_t *dst, int32_t value);
+    void restartSettling();
+    bool settle(int32_t sample);
+    bool updateVoiceActivity();
+    void updateSoundLevel();
     void decimate(Event);
+    void decimateNext();
+    int getFillingBuffer();
+    void decimateBuffer(uint8_t *data);
 };
 
 #endif
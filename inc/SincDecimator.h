@@ -0,0 +1,125 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalConfig.h"
+
+#ifndef SINC_DECIMATOR_H
+#define SINC_DECIMATOR_H
+
+// The number of taps in the windowed sinc filter, which is also its decimation ratio.
+#define SINC_DECIMATOR_TAPS             64
+
+//
+// Selects the decimation engine used to convert PDM data into PCM samples.
+// When enabled, each byte of PDM data is convolved in one step, using partial sums precomputed
+// from the filter for each byte position in the window. Otherwise, the filter is applied one bit at a time.
+// Both produce identical output.
+//
+#ifndef SAMD21_PDM_LUT_DECIMATION
+#define SAMD21_PDM_LUT_DECIMATION      1
+#endif
+
+// a manual loop-unroller!
+#define ADAPDM_REPEAT_LOOP_16(X) X X X X X X X X X X X X X X X X
+
+/**
+ * A 64 tap windowed sinc decimation filter for 1 bit PDM data.
+ *
+ * The filter holds no state between output samples, and is independent of any hardware,
+ * so the same filter can be run on the host.
+ */
+class SincDecimator
+{
+public:
+
+    // The windowed sinc filter taps, for a decimation of 64. Tap 0 weights the chronologically first sample.
+    static constexpr uint16_t filter[SINC_DECIMATOR_TAPS] = {
+        0, 2, 9, 21, 39, 63, 94, 132, 179, 236, 302, 379, 467, 565, 674, 792,
+        920, 1055, 1196, 1341, 1487, 1633, 1776, 1913, 2042, 2159, 2263, 2352, 2422, 2474, 2506, 2516,
+        2506, 2474, 2422, 2352, 2263, 2159, 2042, 1913, 1776, 1633, 1487, 1341, 1196, 1055, 920, 792,
+        674, 565, 467, 379, 302, 236, 179, 132, 94, 63, 39, 21, 9, 2, 0, 0};
+
+#if CONFIG_ENABLED(SAMD21_PDM_LUT_DECIMATION)
+    // The filter contribution of every possible byte value, for each byte position in the window. Generated at compile time.
+    static const uint16_t lookup[SINC_DECIMATOR_TAPS/8][256];
+#endif
+
+    /**
+     * Filters SINC_DECIMATOR_TAPS PDM samples from each channel into a PCM sample.
+     * Defined here so that it is inlined into the decimation loop of its callers.
+     *
+     * @param data SINC_DECIMATOR_TAPS / 16 words of PDM data, as received from the I2S peripheral.
+     * The low half word of each holds the left channel, and the high half word the right.
+     * Bit 0 of each half word is the chronologically first sample.
+     * @param left Set to the signed PCM sample for the left channel.
+     * @param right Set to the signed PCM sample for the right channel, if stereo is true.
+     * @param stereo true if the right channel should be filtered, false otherwise.
+     */
+    static inline void decimate(const uint32_t *data, int32_t &left, int32_t &right, bool stereo)
+    {
+        int32_t runningSum[2] = {0, 0};
+
+#if CONFIG_ENABLED(SAMD21_PDM_LUT_DECIMATION)
+        const uint16_t (*lut)[256] = lookup;
+
+        for (uint8_t samplenum=0; samplenum < (SINC_DECIMATOR_TAPS/16) ; samplenum++) {
+            uint32_t sample = *data++;     // the low half word holds the left channel, the high half word the right
+
+            // Convolve each byte in a single lookup. The low byte holds the earliest samples.
+            runningSum[0] += lut[0][sample & 0xFF] + lut[1][(sample >> 8) & 0xFF];
+
+            if (stereo)
+                runningSum[1] += lut[0][(sample >> 16) & 0xFF] + lut[1][sample >> 24];
+
+            lut += 2;
+        }
+#else
+        const uint16_t *sincPtr = filter;
+
+        for (uint8_t samplenum=0; samplenum < (SINC_DECIMATOR_TAPS/16) ; samplenum++) {
+             uint32_t sample = stereo ? *data++ : *data++ & 0xFFFF;    // the low half word holds the left channel, the high half word the right
+
+             ADAPDM_REPEAT_LOOP_16(      // manually unroll loop: for (int8_t b=0; b<16; b++) 
+               {
+                 // start at the LSB which is the 'first' bit to come down the line, chronologically 
+                 // (Note we had to set I2S_SERCTRL_BITREV to get this to work, but saves us time!)
+                 if (sample & 0x1) {
+                   runningSum[0] += *sincPtr;     // do the convolution
+                 }
+                 if (sample & 0x10000) {
+                   runningSum[1] += *sincPtr;
+                 }
+                 sincPtr++;
+                 sample >>= 1;
+              }
+            )
+        }
+#endif
+
+        left = runningSum[0] - (1<<15);
+        right = runningSum[1] - (1<<15);
+    }
+};
+
+#endif
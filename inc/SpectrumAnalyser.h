@@ -0,0 +1,146 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalConfig.h"
+#include "DataStream.h"
+
+#ifndef SPECTRUM_ANALYSER_H
+#define SPECTRUM_ANALYSER_H
+
+// The largest supported transform size, in samples. The twiddle and window tables are sized to match.
+#define SPECTRUM_ANALYSER_MAX_SIZE          512
+
+// The smallest supported transform size, in samples.
+#define SPECTRUM_ANALYSER_MIN_SIZE          16
+
+#ifndef SPECTRUM_ANALYSER_DEFAULT_SIZE
+#define SPECTRUM_ANALYSER_DEFAULT_SIZE      256
+#endif
+
+// The number of spectrum buffers preallocated by each analyser. One is retained as the most recent spectrum,
+// so this should exceed the number held downstream by at least one.
+#ifndef SPECTRUM_ANALYSER_POOL_SIZE
+#define SPECTRUM_ANALYSER_POOL_SIZE         3
+#endif
+
+using namespace codal;
+
+/**
+ * A spectrum analysis stage for 16 bit mono PCM streams, such as the output of SAMD21PDM.
+ *
+ * Incoming samples are collected into overlapping frames. Each frame is weighted by a Hann window, and transformed
+ * by an in place Q15 FFT. The magnitude of each frequency bin is then published downstream as a buffer of
+ * size / 2 unsigned 16 bit values, where bin k is centred on k * sampleRate / size Hz.
+ * Spectrum buffers are drawn from a preallocated pool, so no heap allocation takes place once the analyser is running.
+ */
+class SpectrumAnalyser : public DataSink, public DataSource
+{
+private:
+
+    DataSource      &upstream;                          // The component producing our PCM input.
+    int             size;                               // The number of samples in each frame, a power of two.
+    int             hop;                                // The number of samples between the start of consecutive frames.
+    int             filled;                             // The number of samples currently held in the frame buffer.
+    ManagedBuffer   frame;                              // The most recent size samples received.
+    ManagedBuffer   work;                               // Scratch space for the transform.
+    ManagedBuffer   spectrum;                           // The magnitude of each bin in the most recent frame.
+    BufferData      *pool[SPECTRUM_ANALYSER_POOL_SIZE]; // Preallocated spectrum buffers, each holding a permanent reference from this component.
+    uint16_t        poolIdleReference;                  // The reference count of a pooled buffer that is not in use elsewhere.
+    uint32_t        poolExhausted;                      // The number of spectra dropped because every pooled buffer was in use.
+
+public:
+
+    // The stream component that is serving our data.
+    DataStream output;
+
+    /**
+     * Constructor for a spectrum analyser, which connects itself to the given source.
+     *
+     * @param source The component producing 16 bit mono PCM samples.
+     * @param size The number of samples in each frame. Rounded down to a power of two between
+     * SPECTRUM_ANALYSER_MIN_SIZE and SPECTRUM_ANALYSER_MAX_SIZE.
+     * @param hop The number of samples between the start of consecutive frames (1..size), or zero for
+     * frames overlapping by half.
+     */
+    SpectrumAnalyser(DataSource &source, int size = SPECTRUM_ANALYSER_DEFAULT_SIZE, int hop = 0);
+
+    /**
+     * Callback provided when data is ready.
+     */
+    virtual int pullRequest();
+
+    /**
+     * Provide the most recent spectrum to our downstream component.
+     */
+    virtual ManagedBuffer pull();
+
+    /**
+     * Register a downstream component to receive each spectrum as it is completed.
+     */
+    virtual void connect(DataSink &sink);
+
+    /**
+     * Determines the number of samples in each frame. Half this number of bins is published per frame.
+     *
+     * @return the frame size, in samples.
+     */
+    int getSize();
+
+    /**
+     * Determines the magnitude of the given frequency bin in the most recent spectrum.
+     *
+     * @param bin The bin of interest, between 0 and getSize() / 2 - 1.
+     *
+     * @return the magnitude of the bin, or DEVICE_INVALID_PARAMETER if the bin is out of range.
+     */
+    int getMagnitude(int bin);
+
+    /**
+     * Determines the frequency bin holding the most energy in the most recent spectrum, ignoring the DC bin.
+     *
+     * @return the index of the loudest bin, or zero if no spectrum is yet available.
+     */
+    int getPeakBin();
+
+    /**
+     * Determines how often a spectrum was dropped because every buffer in the pool was still held downstream.
+     *
+     * @return the number of spectra dropped since this component was created.
+     */
+    uint32_t getPoolExhaustedCount();
+
+    /**
+     * Computes the magnitude spectrum of a frame of real valued samples.
+     * A size point real transform is computed using a size / 2 point complex transform, scaling by 1/2 each stage
+     * to avoid overflow. A full scale sine wave therefore produces a magnitude of approximately 16384 in its bin.
+     *
+     * @param samples The size samples to analyse.
+     * @param work Scratch space for size values.
+     * @param magnitude Set to the size / 2 bin magnitudes.
+     * @param size The number of samples, a power of two between SPECTRUM_ANALYSER_MIN_SIZE and SPECTRUM_ANALYSER_MAX_SIZE.
+     */
+    static void transform(const int16_t *samples, int16_t *work, uint16_t *magnitude, int size);
+};
+
+#endif
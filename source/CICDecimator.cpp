@@ -0,0 +1,209 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CICDecimator.h"
+
+/**
+ * Computes the binomial coefficient (n k).
+ */
+static constexpr uint16_t cicBinomial(int n, int k)
+{
+    return k == 0 ? 1 : cicBinomial(n - 1, k - 1) * n / k;
+}
+
+/**
+ * Computes the contribution of a single byte of PDM data to the given (zero based) integrator stage,
+ * after the byte has been fed through all stages. Bit 0 is the chronologically first sample.
+ */
+static constexpr uint16_t cicStepEntry(int stage, int value, int bit = 0)
+{
+    return bit == 8 ? 0 : (((value >> bit) & 1) ? cicBinomial(7 - bit + stage, stage) : 0) + cicStepEntry(stage, value, bit + 1);
+}
+
+#define CIC_STEP_1(s, v)    cicStepEntry(s, v)
+#define CIC_STEP_4(s, v)    CIC_STEP_1(s, v), CIC_STEP_1(s, v+1), CIC_STEP_1(s, v+2), CIC_STEP_1(s, v+3)
+#define CIC_STEP_16(s, v)   CIC_STEP_4(s, v), CIC_STEP_4(s, v+4), CIC_STEP_4(s, v+8), CIC_STEP_4(s, v+12)
+#define CIC_STEP_64(s, v)   CIC_STEP_16(s, v), CIC_STEP_16(s, v+16), CIC_STEP_16(s, v+32), CIC_STEP_16(s, v+48)
+#define CIC_STEP(s)         { CIC_STEP_64(s, 0), CIC_STEP_64(s, 64), CIC_STEP_64(s, 128), CIC_STEP_64(s, 192) }
+
+/**
+ * The contribution of every possible byte value to each integrator stage, held in flash.
+ */
+const uint16_t cicStep[CIC_DECIMATOR_MAX_STAGES][256] = {
+    CIC_STEP(0), CIC_STEP(1), CIC_STEP(2), CIC_STEP(3)
+};
+
+/**
+ * Side tap of the compensation FIR for each stage count, in Q8.
+ * Chosen to flatten the response of the CIC at a quarter of the output sample rate.
+ */
+const uint8_t cicCompensation[CIC_DECIMATOR_MAX_STAGES] = {14, 30, 47, 67};
+
+/**
+ * Constructor.
+ *
+ * @param decimation The number of PDM samples per PCM sample. Must be a power of two between 16 and 256.
+ * @param stages The number of integrator/comb stages, between 1 and CIC_DECIMATOR_MAX_STAGES.
+ */
+CICDecimator::CICDecimator(int decimation, int stages)
+{
+    this->stages = 0;
+
+    if (configure(decimation, stages) != DEVICE_OK)
+        configure(64, CIC_DECIMATOR_MAX_STAGES);
+}
+
+/**
+ * Changes the decimation ratio and number of stages of this filter, and resets its state.
+ * Higher stage counts give better rejection of aliased noise at a higher cost per sample.
+ *
+ * @param decimation The number of PDM samples per PCM sample. Must be a power of two between 16 and 256.
+ * @param stages The number of integrator/comb stages, between 1 and CIC_DECIMATOR_MAX_STAGES.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the configuration is not supported
+ * (including those where decimation^stages exceeds 2^31).
+ */
+int CICDecimator::configure(int decimation, int stages)
+{
+    int bits = 0;
+
+    if (decimation < 16 || decimation > 256 || (decimation & (decimation - 1)))
+        return DEVICE_INVALID_PARAMETER;
+
+    if (stages < 1 || stages > CIC_DECIMATOR_MAX_STAGES)
+        return DEVICE_INVALID_PARAMETER;
+
+    while ((1 << bits) < decimation)
+        bits++;
+
+    // The output range of the CIC must fit in our (modulo) 32 bit arithmetic.
+    if (bits * stages > 31)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->decimation = decimation;
+    this->stages = stages;
+    this->gain = bits * stages;
+    this->compensation = cicCompensation[stages - 1];
+
+    reset();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Clears all filter state.
+ */
+void CICDecimator::reset()
+{
+    for (int i = 0; i < CIC_DECIMATOR_MAX_STAGES; i++)
+    {
+        integrator[i] = 0;
+        comb[i] = 0;
+    }
+
+    history[0] = history[1] = 0;
+}
+
+/**
+ * Feeds 16 PDM samples into the integrators.
+ *
+ * @param bits The PDM samples, in the low 16 bits. Bit 0 is the chronologically first sample.
+ */
+void CICDecimator::integrate(uint32_t bits)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        uint8_t v = bits & 0xFF;
+        bits >>= 8;
+
+        // Advance each integrator by eight samples at once. Higher stages are updated first,
+        // as they depend upon the state of the lower stages before this byte was applied.
+        switch (stages)
+        {
+            case 4:
+                integrator[3] += 8*integrator[2] + 36*integrator[1] + 120*integrator[0] + cicStep[3][v];
+                // fall through
+            case 3:
+                integrator[2] += 8*integrator[1] + 36*integrator[0] + cicStep[2][v];
+                // fall through
+            case 2:
+                integrator[1] += 8*integrator[0] + cicStep[1][v];
+                // fall through
+            case 1:
+                integrator[0] += cicStep[0][v];
+        }
+    }
+}
+
+/**
+ * Generates a PCM sample from the PDM data integrated since the last call.
+ * Should be called after every (decimation / 16) calls to integrate().
+ *
+ * @return a signed 16 bit PCM sample.
+ */
+int16_t CICDecimator::decimate()
+{
+    uint32_t v = integrator[stages - 1];
+
+    for (int i = 0; i < stages; i++)
+    {
+        uint32_t t = v - comb[i];
+        comb[i] = v;
+        v = t;
+    }
+
+    // Normalise the CIC output from [0..2^gain] to a signed 16 bit range.
+    int32_t sample = gain >= 16 ? (int32_t)(v >> (gain - 16)) : (int32_t)(v << (16 - gain));
+    sample -= (1 << 15);
+
+    // Apply the droop compensation FIR. This delays the output by one sample.
+    int32_t y = ((256 + 2*compensation) * history[0] - compensation * (sample + history[1])) >> 8;
+
+    history[1] = history[0];
+    history[0] = sample;
+
+    if (y > 32767)
+        y = 32767;
+
+    if (y < -32768)
+        y = -32768;
+
+    return y;
+}
+
+/**
+ * Determines the decimation ratio of this filter.
+ */
+int CICDecimator::getDecimation()
+{
+    return decimation;
+}
+
+/**
+ * Determines the number of integrator/comb stages in this filter.
+ */
+int CICDecimator::getStages()
+{
+    return stages;
+}
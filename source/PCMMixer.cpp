@@ -0,0 +1,304 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalCompat.h"
+#include "PCMMixer.h"
+#include "codal_target_hal.h"
+
+/**
+ * Pulls announced buffers from our source, for as long as we have room to hold them.
+ * Must be called with interrupts disabled.
+ */
+void PCMMixerInput::fill()
+{
+    while (dataReady && queueTail - queueHead < PCM_MIXER_INPUT_QUEUE_SIZE)
+    {
+        ManagedBuffer b = source->pull();
+        dataReady--;
+
+        if (b.length() < 2)
+        {
+            dataReady = 0;
+            break;
+        }
+
+        queue[queueTail % PCM_MIXER_INPUT_QUEUE_SIZE] = b;
+        queueTail++;
+        available += b.length() / 2;
+    }
+}
+
+/**
+ * Callback provided when data is ready.
+ */
+int PCMMixerInput::pullRequest()
+{
+    target_disable_irq();
+    dataReady++;
+    fill();
+    target_enable_irq();
+
+    mixer->update();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Constructor for a mixer with no inputs.
+ *
+ * @param blockSize The number of samples in each mixed output buffer.
+ */
+PCMMixer::PCMMixer(int blockSize) : output(*this)
+{
+    this->blockSize = blockSize < 1 ? PCM_MIXER_DEFAULT_BLOCK_SIZE : blockSize;
+    this->requested = 0;
+    this->poolExhausted = 0;
+
+    for (int i = 0; i < PCM_MIXER_MAX_INPUTS; i++)
+    {
+        inputs[i].mixer = this;
+        inputs[i].source = NULL;
+        inputs[i].gain = PCM_MIXER_UNITY_GAIN;
+        inputs[i].dataReady = 0;
+        inputs[i].queueHead = 0;
+        inputs[i].queueTail = 0;
+        inputs[i].position = 0;
+        inputs[i].available = 0;
+    }
+
+    // Allocate all of our output buffers up front, so that no heap allocation takes place during playback.
+    // The pool retains a reference to each, so they are never freed.
+    for (int i = 0; i < PCM_MIXER_POOL_SIZE; i++)
+        pool[i] = ManagedBuffer(this->blockSize * 2).leakData();
+
+    poolIdleReference = pool[0]->refCount;
+
+    output.setBlocking(false);
+}
+
+/**
+ * Adds an input to the mixer, and connects it to the given source.
+ *
+ * @param source The component producing signed 16 bit mono PCM samples.
+ * @param gain The gain applied to the input, in 1/256ths (PCM_MIXER_UNITY_GAIN is unity).
+ *
+ * @return the index of the new input, or DEVICE_NO_RESOURCES if PCM_MIXER_MAX_INPUTS are already in use.
+ */
+int PCMMixer::addInput(DataSource &source, int gain)
+{
+    for (int i = 0; i < PCM_MIXER_MAX_INPUTS; i++)
+    {
+        if (inputs[i].source == NULL)
+        {
+            inputs[i].source = &source;
+            setGain(i, gain);
+            source.connect(inputs[i]);
+
+            return i;
+        }
+    }
+
+    return DEVICE_NO_RESOURCES;
+}
+
+/**
+ * Sets the gain applied to the given input.
+ *
+ * @param input The index of the input, as returned by addInput().
+ * @param gain The gain, in 1/256ths (PCM_MIXER_UNITY_GAIN is unity). Up to 16x (4096) is supported.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the input or gain is out of range.
+ */
+int PCMMixer::setGain(int input, int gain)
+{
+    if (input < 0 || input >= PCM_MIXER_MAX_INPUTS || gain < 0 || gain > 16 * PCM_MIXER_UNITY_GAIN)
+        return DEVICE_INVALID_PARAMETER;
+
+    inputs[input].gain = gain;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines how often an output buffer could not be provided because all were still held downstream.
+ *
+ * @return the number of output buffers dropped since this component was created.
+ */
+uint32_t PCMMixer::getPoolExhaustedCount()
+{
+    return poolExhausted;
+}
+
+/**
+ * Announces as many output buffers downstream as our best supplied input can fill.
+ * Buffers announced by an input but not yet pulled are assumed to fill at least one output buffer each.
+ */
+void PCMMixer::update()
+{
+    int blocks = 0;
+
+    target_disable_irq();
+
+    for (int i = 0; i < PCM_MIXER_MAX_INPUTS; i++)
+        blocks = max(blocks, (inputs[i].available + blockSize - 1) / blockSize + inputs[i].dataReady);
+
+    int announce = blocks - requested;
+
+    if (announce > 0)
+        requested += announce;
+
+    target_enable_irq();
+
+    while (announce-- > 0)
+        output.pullRequest();
+}
+
+/**
+ * Mix the data waiting at each input into a new output buffer, and provide it to our downstream component.
+ */
+ManagedBuffer PCMMixer::pull()
+{
+    PCMMixerInput *active[PCM_MIXER_MAX_INPUTS];
+    const int16_t *src[PCM_MIXER_MAX_INPUTS];
+    int32_t gain[PCM_MIXER_MAX_INPUTS];
+    ManagedBuffer buffer;
+
+    target_disable_irq();
+
+    if (requested)
+        requested--;
+
+    target_enable_irq();
+
+    // Only produce output if at least one input has data. Otherwise, signal the end of the stream.
+    bool waiting = false;
+    for (int i = 0; i < PCM_MIXER_MAX_INPUTS; i++)
+        waiting |= inputs[i].available > 0;
+
+    if (!waiting)
+        return buffer;
+
+    for (int i = 0; i < PCM_MIXER_POOL_SIZE; i++)
+    {
+        if (pool[i]->refCount == poolIdleReference)
+        {
+            buffer = ManagedBuffer(pool[i]);
+            break;
+        }
+    }
+
+    if (buffer.length() == 0)
+    {
+        poolExhausted++;
+        return buffer;
+    }
+
+    int16_t *out = (int16_t *) &buffer[0];
+    int remaining = blockSize;
+
+    // Mix in spans over which every input with data has contiguous samples, so each output sample is computed in one pass.
+    while (remaining)
+    {
+        int count = 0;
+        int span = remaining;
+
+        for (int i = 0; i < PCM_MIXER_MAX_INPUTS; i++)
+        {
+            PCMMixerInput &in = inputs[i];
+
+            if (in.available == 0)
+                continue;
+
+            ManagedBuffer &b = in.queue[in.queueHead % PCM_MIXER_INPUT_QUEUE_SIZE];
+
+            active[count] = &in;
+            src[count] = (const int16_t *) &b[0] + in.position;
+            gain[count] = in.gain;
+            count++;
+
+            span = min(span, b.length() / 2 - in.position);
+        }
+
+        // Any inputs exhausted part way through the buffer contribute silence to the rest of it.
+        if (count == 0)
+        {
+            memset(out, 0, remaining * 2);
+            break;
+        }
+
+        for (int i = 0; i < span; i++)
+        {
+            int32_t v = 0;
+
+            for (int c = 0; c < count; c++)
+                v += src[c][i] * gain[c];
+
+            v >>= 8;
+
+            if (v > 32767)
+                v = 32767;
+
+            if (v < -32768)
+                v = -32768;
+
+            out[i] = v;
+        }
+
+        out += span;
+        remaining -= span;
+
+        // Advance each input, releasing any buffers fully consumed and pulling any more that have been announced.
+        // Inputs update the same queue state as their sources announce data, possibly from an interrupt.
+        target_disable_irq();
+
+        for (int c = 0; c < count; c++)
+        {
+            PCMMixerInput &in = *active[c];
+            ManagedBuffer &b = in.queue[in.queueHead % PCM_MIXER_INPUT_QUEUE_SIZE];
+
+            in.position += span;
+            in.available -= span;
+
+            if (in.position == b.length() / 2)
+            {
+                b = ManagedBuffer();
+                in.queueHead++;
+                in.position = 0;
+                in.fill();
+            }
+        }
+
+        target_enable_irq();
+    }
+
+    return buffer;
+}
+
+/**
+ * Register a downstream component to receive mixed buffers.
+ */
+void PCMMixer::connect(DataSink &sink)
+{
+    output.connect(sink);
+}
@@ -0,0 +1,347 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalCompat.h"
+#include "PCMResampler.h"
+
+//
+// A Kaiser windowed (beta = 6) sinc interpolation filter with a cutoff of 90% of the input Nyquist frequency.
+// With only PCM_RESAMPLER_TAPS taps the transition is gradual: the response is flat (within 0.1dB) to 50%,
+// 3dB down at 80% and 6dB down at the 90% cutoff.
+// Row p holds the taps for an output sample p / PCM_RESAMPLER_PHASES of the way between input samples.
+// The final row completes the interval, so that coefficients can be interpolated between adjacent rows.
+// Each row sums to unity gain in Q15.
+//
+static const int16_t phaseTable[PCM_RESAMPLER_PHASES + 1][PCM_RESAMPLER_TAPS] = {
+    {459, -1478, 2704, 29435, 2704, -1478, 459, -37},
+    {432, -1359, 2286, 29425, 3135, -1598, 487, -40},
+    {405, -1242, 1879, 29396, 3578, -1719, 515, -44},
+    {378, -1126, 1485, 29343, 4032, -1840, 543, -47},
+    {351, -1013, 1104, 29271, 4497, -1962, 571, -51},
+    {325, -901, 735, 29177, 4972, -2085, 599, -54},
+    {300, -792, 379, 29063, 5457, -2207, 626, -58},
+    {275, -685, 37, 28926, 5952, -2328, 653, -62},
+    {250, -581, -292, 28768, 6457, -2449, 680, -65},
+    {226, -479, -607, 28590, 6969, -2569, 707, -69},
+    {203, -381, -908, 28392, 7490, -2687, 732, -73},
+    {181, -285, -1196, 28172, 8019, -2804, 757, -76},
+    {160, -193, -1470, 27934, 8554, -2918, 781, -80},
+    {139, -104, -1730, 27676, 9096, -3030, 804, -83},
+    {119, -19, -1977, 27401, 9644, -3139, 826, -87},
+    {100, 64, -2209, 27103, 10197, -3244, 847, -90},
+    {82, 142, -2428, 26790, 10754, -3346, 867, -93},
+    {65, 217, -2633, 26457, 11316, -3444, 885, -95},
+    {48, 289, -2824, 26108, 11881, -3537, 901, -98},
+    {33, 356, -3001, 25742, 12448, -3626, 916, -100},
+    {18, 420, -3166, 25361, 13017, -3709, 929, -102},
+    {4, 480, -3317, 24964, 13588, -3787, 940, -104},
+    {-8, 537, -3454, 24549, 14159, -3859, 949, -105},
+    {-20, 590, -3579, 24122, 14729, -3924, 956, -106},
+    {-32, 639, -3691, 23681, 15299, -3983, 961, -106},
+    {-42, 684, -3791, 23228, 15867, -4035, 963, -106},
+    {-51, 726, -3878, 22759, 16433, -4078, 963, -106},
+    {-60, 764, -3954, 22282, 16995, -4114, 960, -105},
+    {-68, 798, -4018, 21793, 17554, -4142, 954, -103},
+    {-75, 829, -4070, 21292, 18108, -4161, 946, -101},
+    {-81, 857, -4111, 20781, 18656, -4170, 934, -98},
+    {-86, 881, -4141, 20261, 19198, -4170, 920, -95},
+    {-91, 902, -4161, 19734, 19734, -4161, 902, -91},
+    {-95, 920, -4170, 19198, 20261, -4141, 881, -86},
+    {-98, 934, -4170, 18656, 20781, -4111, 857, -81},
+    {-101, 946, -4161, 18108, 21292, -4070, 829, -75},
+    {-103, 954, -4142, 17554, 21793, -4018, 798, -68},
+    {-105, 960, -4114, 16995, 22282, -3954, 764, -60},
+    {-106, 963, -4078, 16433, 22759, -3878, 726, -51},
+    {-106, 963, -4035, 15867, 23228, -3791, 684, -42},
+    {-106, 961, -3983, 15299, 23681, -3691, 639, -32},
+    {-106, 956, -3924, 14729, 24122, -3579, 590, -20},
+    {-105, 949, -3859, 14159, 24549, -3454, 537, -8},
+    {-104, 940, -3787, 13588, 24964, -3317, 480, 4},
+    {-102, 929, -3709, 13017, 25361, -3166, 420, 18},
+    {-100, 916, -3626, 12448, 25742, -3001, 356, 33},
+    {-98, 901, -3537, 11881, 26108, -2824, 289, 48},
+    {-95, 885, -3444, 11316, 26457, -2633, 217, 65},
+    {-93, 867, -3346, 10754, 26790, -2428, 142, 82},
+    {-90, 847, -3244, 10197, 27103, -2209, 64, 100},
+    {-87, 826, -3139, 9644, 27401, -1977, -19, 119},
+    {-83, 804, -3030, 9096, 27676, -1730, -104, 139},
+    {-80, 781, -2918, 8554, 27934, -1470, -193, 160},
+    {-76, 757, -2804, 8019, 28172, -1196, -285, 181},
+    {-73, 732, -2687, 7490, 28392, -908, -381, 203},
+    {-69, 707, -2569, 6969, 28590, -607, -479, 226},
+    {-65, 680, -2449, 6457, 28768, -292, -581, 250},
+    {-62, 653, -2328, 5952, 28926, 37, -685, 275},
+    {-58, 626, -2207, 5457, 29063, 379, -792, 300},
+    {-54, 599, -2085, 4972, 29177, 735, -901, 325},
+    {-51, 571, -1962, 4497, 29271, 1104, -1013, 351},
+    {-47, 543, -1840, 4032, 29343, 1485, -1126, 378},
+    {-44, 515, -1719, 3578, 29396, 1879, -1242, 405},
+    {-40, 487, -1598, 3135, 29425, 2286, -1359, 432},
+    {-37, 459, -1478, 2704, 29435, 2704, -1478, 459}
+};
+
+/**
+ * Constructor for a resampler, which connects itself to the given source.
+ * Only the ratio of inputRate to outputRate is significant, so a fractional rate can be given exactly by scaling
+ * both. For example, a source producing n/d Hz is converted to r Hz with an inputRate of n and an outputRate of d * r.
+ *
+ * @param source The component producing signed 16 bit PCM samples.
+ * @param inputRate The sample rate of the source.
+ * @param outputRate The sample rate required.
+ * @param channels The number of interleaved channels in the stream (1 or 2).
+ * @param method One of PCM_RESAMPLER_LINEAR or PCM_RESAMPLER_POLYPHASE.
+ */
+PCMResampler::PCMResampler(DataSource &source, uint32_t inputRate, uint32_t outputRate, int channels, int method) : upstream(source), output(*this)
+{
+    this->method = method == PCM_RESAMPLER_LINEAR ? PCM_RESAMPLER_LINEAR : PCM_RESAMPLER_POLYPHASE;
+    this->channels = channels == 2 ? 2 : 1;
+    this->position = PCM_RESAMPLER_TAPS / 2 - 1;
+    this->fraction = 0;
+
+    memset(history, 0, sizeof(history));
+
+    // Allocate all of our output buffers up front. The pool retains a reference to each, so they are never freed.
+    for (int i = 0; i < PCM_RESAMPLER_POOL_SIZE; i++)
+    {
+        poolCapacity[i] = PCM_RESAMPLER_DEFAULT_BLOCK_SIZE * this->channels * sizeof(int16_t);
+        pool[i] = ManagedBuffer(poolCapacity[i]).leakData();
+    }
+
+    poolIdleReference = pool[0]->refCount;
+    poolExhausted = 0;
+
+    if (setRates(inputRate, outputRate) != DEVICE_OK)
+        setRates(1, 1);
+
+    upstream.connect(*this);
+}
+
+/**
+ * Changes the conversion ratio. Only the ratio of inputRate to outputRate is significant.
+ *
+ * @param inputRate The sample rate of the source.
+ * @param outputRate The sample rate required.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if either rate is zero.
+ */
+int PCMResampler::setRates(uint32_t inputRate, uint32_t outputRate)
+{
+    if (inputRate == 0 || outputRate == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    uint64_t remainder = (uint64_t)(inputRate % outputRate) << 32;
+
+    this->inputRate = inputRate;
+    this->outputRate = outputRate;
+    this->step = inputRate / outputRate;
+    this->stepFraction = remainder / outputRate;
+    this->stepError = remainder % outputRate;
+    this->error = 0;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines how often a block of output was dropped because every buffer in the pool was still held downstream.
+ *
+ * @return The number of output blocks dropped since the resampler was created.
+ */
+uint32_t PCMResampler::getPoolExhaustedCount()
+{
+    return poolExhausted;
+}
+
+/**
+ * Callback provided when data is ready.
+ */
+int PCMResampler::pullRequest()
+{
+    ManagedBuffer b = upstream.pull();
+
+    int frames = b.length() / (sizeof(int16_t) * channels);
+
+    // An empty buffer completes no output samples, so there is nothing to pass on.
+    if (frames == 0)
+        return DEVICE_OK;
+
+    int available = PCM_RESAMPLER_TAPS + frames;
+    int last = available - PCM_RESAMPLER_TAPS / 2;
+
+    // Determine how many output samples this buffer completes.
+    int count = 0;
+    int p = position;
+    uint32_t f = fraction;
+    uint32_t e = error;
+
+    while (p < last)
+    {
+        uint32_t next = f + stepFraction;
+        p += step + (next < f);
+        f = next;
+
+        e += stepError;
+        if (e >= outputRate)
+        {
+            e -= outputRate;
+            if (++f == 0)
+                p++;
+        }
+
+        count++;
+    }
+
+    // Keep the position at the end of this buffer, as the output is dropped if no pooled buffer is free.
+    int end = p;
+    uint32_t endFraction = f;
+    uint32_t endError = e;
+
+    if (input.length() < (int)(available * sizeof(int16_t)))
+        input = ManagedBuffer(available * sizeof(int16_t));
+
+    if (count)
+    {
+        int length = count * channels * sizeof(int16_t);
+        BufferData *next = NULL;
+
+        for (int i = 0; i < PCM_RESAMPLER_POOL_SIZE; i++)
+        {
+            if (pool[i]->refCount == poolIdleReference)
+            {
+                // The number of output samples varies by one between blocks of the same size, so leave room for that.
+                if (poolCapacity[i] < length)
+                {
+                    pool[i]->decr();
+                    poolCapacity[i] = length + channels * sizeof(int16_t);
+                    pool[i] = ManagedBuffer(poolCapacity[i]).leakData();
+                }
+
+                next = pool[i];
+                break;
+            }
+        }
+
+        if (next)
+        {
+            next->length = length;
+            buffer = ManagedBuffer(next);
+        }
+        else
+        {
+            // Still retain this block as history, so that the stream remains continuous.
+            poolExhausted++;
+            count = 0;
+        }
+    }
+
+    const int16_t *in = (const int16_t *) &b[0];
+    int16_t *x = (int16_t *) &input[0];
+
+    // Resample each channel in turn, from a contiguous copy of its samples preceded by its history.
+    for (int c = 0; c < channels; c++)
+    {
+        int16_t *out = (int16_t *) &buffer[0] + c;
+
+        memcpy(x, history[c], sizeof(history[c]));
+
+        for (int i = 0; i < frames; i++)
+            x[PCM_RESAMPLER_TAPS + i] = in[i * channels + c];
+
+        p = position;
+        f = fraction;
+        e = error;
+
+        for (int i = 0; i < count; i++)
+        {
+            int32_t v;
+
+            if (method == PCM_RESAMPLER_LINEAR)
+            {
+                v = x[p] + (((x[p + 1] - x[p]) * (int32_t)(f >> 17)) >> 15);
+            }
+            else
+            {
+                // Select the filter phases either side of the output position, and interpolate between them.
+                const int16_t *h0 = phaseTable[f >> 26];
+                const int16_t *h1 = phaseTable[(f >> 26) + 1];
+                const int16_t *s = &x[p - (PCM_RESAMPLER_TAPS / 2 - 1)];
+                int32_t weight = (f >> 11) & 0x7FFF;
+
+                v = 0;
+                for (int k = 0; k < PCM_RESAMPLER_TAPS; k++)
+                    v += s[k] * (h0[k] + (((h1[k] - h0[k]) * weight) >> 15));
+
+                v >>= 15;
+
+                if (v > 32767)
+                    v = 32767;
+
+                if (v < -32768)
+                    v = -32768;
+            }
+
+            *out = v;
+            out += channels;
+
+            uint32_t next = f + stepFraction;
+            p += step + (next < f);
+            f = next;
+
+            e += stepError;
+            if (e >= outputRate)
+            {
+                e -= outputRate;
+                if (++f == 0)
+                    p++;
+            }
+        }
+
+        memcpy(history[c], &x[frames], sizeof(history[c]));
+    }
+
+    // Carry our position over into the next buffer, which follows the history we have just retained.
+    position = end - frames;
+    fraction = endFraction;
+    error = endError;
+
+    if (count)
+        output.pullRequest();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Provide the most recent resampled buffer to our downstream component.
+ */
+ManagedBuffer PCMResampler::pull()
+{
+    return buffer;
+}
+
+/**
+ * Register a downstream component to receive each buffer as it is resampled.
+ */
+void PCMResampler::connect(DataSink &sink)
+{
+    output.connect(sink);
+}
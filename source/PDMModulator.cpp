@@ -0,0 +1,105 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "PDMModulator.h"
+
+/**
+ * Constructor.
+ */
+PDMModulator::PDMModulator()
+{
+    reset();
+}
+
+/**
+ * Clears all modulator state.
+ */
+void PDMModulator::reset()
+{
+    integrator[0] = 0;
+    integrator[1] = 0;
+    previous = 0;
+}
+
+/**
+ * Generates 16 PDM samples representing the given PCM sample.
+ *
+ * @param sample A signed 16 bit PCM sample. The modulator is stable for samples within 3/4 of full scale.
+ *
+ * @return the PDM samples in the low 16 bits. Bit 0 is the chronologically first sample.
+ */
+uint16_t PDMModulator::modulate(int16_t sample)
+{
+    uint16_t bits = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        // Quantise to a single bit, and feed the error back into both integrators.
+        int32_t feedback = -32768;
+
+        if (integrator[1] >= 0)
+        {
+            bits |= (1 << i);
+            feedback = 32767;
+        }
+
+        integrator[0] += sample - feedback;
+        integrator[1] += integrator[0] - feedback;
+    }
+
+    return bits;
+}
+
+/**
+ * Generates a PDM bitstream from a buffer of PCM samples, interpolating linearly between them.
+ * The PDM data for each sample is written into one half of (decimation / 16) consecutive 32 bit words,
+ * as received from the I2S peripheral. The other half of each word is left unchanged, so two modulators can
+ * be used to generate a stereo bitstream.
+ *
+ * @param pcm The PCM samples to modulate.
+ * @param length The number of PCM samples.
+ * @param pdm The buffer to write PDM data into. Must hold (length * decimation / 16) words.
+ * @param decimation The number of PDM samples per PCM sample. Must be a multiple of 16.
+ * @param channel 0 to write the low half word (left channel), 1 to write the high half word (right channel).
+ */
+void PDMModulator::modulate(const int16_t *pcm, int length, uint32_t *pdm, int decimation, int channel)
+{
+    int words = decimation / 16;
+    int shift = channel ? 16 : 0;
+    uint32_t mask = 0xFFFF << shift;
+
+    for (int i = 0; i < length; i++)
+    {
+        int32_t delta = pcm[i] - previous;
+
+        for (int w = 1; w <= words; w++)
+        {
+            int16_t sample = previous + (delta * w) / words;
+            *pdm = (*pdm & ~mask) | ((uint32_t)modulate(sample) << shift);
+            pdm++;
+        }
+
+        previous = pcm[i];
+    }
+}
@@ -0,0 +1,269 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "SAMD21ClockPlanner.h"
+
+/**
+ * Constructor. Creates a planner with no clock sources.
+ */
+SAMD21ClockPlanner::SAMD21ClockPlanner()
+{
+    sources = 0;
+    dpllReference = 0;
+    dpllGenerator = 0;
+    ditherMax = SAMD21_CLOCK_PLANNER_DITHER_MAX;
+}
+
+/**
+ * Adds a clock generator that is already running, and may drive the timer directly.
+ *
+ * @param generator The clock generator.
+ * @param frequency The frequency of the generator, in Hz. At most SAMD21_CLOCK_PLANNER_TC_MAX.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the frequency is out of range, or
+ * DEVICE_NO_RESOURCES if SAMD21_CLOCK_PLANNER_MAX_SOURCES have already been added.
+ */
+int SAMD21ClockPlanner::addSource(int generator, uint32_t frequency)
+{
+    if (frequency == 0 || frequency > SAMD21_CLOCK_PLANNER_TC_MAX)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (sources == SAMD21_CLOCK_PLANNER_MAX_SOURCES)
+        return DEVICE_NO_RESOURCES;
+
+    sourceGenerator[sources] = generator;
+    sourceFrequency[sources] = frequency;
+    sources++;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Allows the DPLL to be used, driving the given clock generator.
+ *
+ * @param reference The frequency of the DPLL's reference clock, in Hz, or zero to disallow use of the DPLL.
+ * @param generator The clock generator to be driven by the DPLL. Must have an 8 bit divider (generators 3 to 8).
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the reference is out of the DPLL's range (32kHz to 2MHz).
+ */
+int SAMD21ClockPlanner::setDpll(uint32_t reference, int generator)
+{
+    if (reference && (reference < 32000 || reference > 2000000))
+        return DEVICE_INVALID_PARAMETER;
+
+    dpllReference = reference;
+    dpllGenerator = generator;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Limits the length of the dither pattern, for instance where no DMA channel is available to apply it.
+ *
+ * @param length The longest dither pattern permitted, between 1 (no dithering) and SAMD21_CLOCK_PLANNER_DITHER_MAX.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the length is out of range.
+ */
+int SAMD21ClockPlanner::setDitherLimit(uint32_t length)
+{
+    if (length < 1 || length > SAMD21_CLOCK_PLANNER_DITHER_MAX)
+        return DEVICE_INVALID_PARAMETER;
+
+    ditherMax = length;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Computes the error of a sample clock, in parts per billion.
+ *
+ * @param clock The number of clock cycles in the given time, at the clock's frequency.
+ * @param ticks The number of clock cycles taken to generate the same number of samples.
+ * @param rate The requested sample rate.
+ *
+ * The sample rate achieved is clock / ticks. For instance, a clock of f Hz dividing to K ticks over b samples
+ * gives f*b / K.
+ */
+int32_t SAMD21ClockPlanner::error(uint64_t clock, uint64_t ticks, uint32_t rate)
+{
+    int64_t difference = (int64_t) clock - (int64_t) (ticks * rate);
+    int64_t scale = ticks * rate;
+
+    // Round to the nearest part per billion.
+    difference *= 1000000000;
+    difference += difference < 0 ? -(scale / 2) : scale / 2;
+
+    return difference / scale;
+}
+
+/**
+ * Determines if one plan is better than another: more accurate, or as accurate with less dither,
+ * or as accurate with the same dither but without starting the DPLL.
+ */
+bool SAMD21ClockPlanner::better(SAMD21ClockPlan &candidate, SAMD21ClockPlan &best)
+{
+    uint32_t e1 = candidate.error < 0 ? -candidate.error : candidate.error;
+    uint32_t e2 = best.error < 0 ? -best.error : best.error;
+
+    if (e1 != e2)
+        return e1 < e2;
+
+    if (candidate.ditherLength != best.ditherLength)
+        return candidate.ditherLength < best.ditherLength;
+
+    return !candidate.dpll && best.dpll;
+}
+
+/**
+ * Plans the most accurate sample clock for the given rate.
+ *
+ * @param rate The sample rate, in Hz.
+ * @param plan The plan to fill in.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if no clock source can generate the rate.
+ */
+int SAMD21ClockPlanner::plan(uint32_t rate, SAMD21ClockPlan &plan)
+{
+    SAMD21ClockPlan candidate;
+    bool found = false;
+
+    if (rate == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Consider each clock source, dividing to K ticks over each possible length of dither pattern, b.
+    // Patterns are considered shortest first, so the shortest is chosen where several are equally accurate.
+    for (int s = 0; s < sources; s++)
+    {
+        uint64_t f = sourceFrequency[s];
+
+        for (uint32_t b = 1; b <= ditherMax; b++)
+        {
+            uint64_t k = (f * b + rate / 2) / rate;
+            uint32_t period = k / b;
+            uint32_t count = k % b;
+
+            if (period < 2 || period + (count ? 1 : 0) > SAMD21_CLOCK_PLANNER_PERIOD_MAX)
+                continue;
+
+            candidate.generator = sourceGenerator[s];
+            candidate.dpll = false;
+            candidate.dpllRatio = 0;
+            candidate.dpllFraction = 0;
+            candidate.divider = 1;
+            candidate.clock = f;
+            candidate.period = period;
+            candidate.ditherCount = count;
+            candidate.ditherLength = count ? b : 1;
+            candidate.error = error(f * b, k, rate);
+
+            if (!found || better(candidate, plan))
+            {
+                plan = candidate;
+                found = true;
+            }
+
+            if (candidate.error == 0)
+                break;
+        }
+    }
+
+    // Consider DPLL frequencies that are close to a multiple n of the sample rate. The DPLL generates the reference
+    // frequency multiplied by m/16, and is then divided by d in a clock generator, and by n/d in the timer.
+    if (dpllReference)
+    {
+        uint64_t ref = dpllReference;
+        uint32_t first = (SAMD21_CLOCK_PLANNER_DPLL_MIN + rate - 1) / rate;
+        uint32_t last = SAMD21_CLOCK_PLANNER_DPLL_MAX / rate;
+
+        for (uint32_t n = first; n <= last; n++)
+        {
+            uint64_t m = (16 * (uint64_t) rate * n + ref / 2) / ref;
+            uint64_t output = ref * m;                              // 16 times the DPLL frequency.
+
+            if (m < 16 || m / 16 - 1 > SAMD21_CLOCK_PLANNER_DPLL_LDR_MAX)
+                continue;
+
+            if (output < 16 * (uint64_t) SAMD21_CLOCK_PLANNER_DPLL_MIN || output > 16 * (uint64_t) SAMD21_CLOCK_PLANNER_DPLL_MAX)
+                continue;
+
+            // Find the smallest division in the clock generator that brings the DPLL within the timer's range.
+            uint32_t d = (output + 16 * (uint64_t) SAMD21_CLOCK_PLANNER_TC_MAX - 1) / (16 * (uint64_t) SAMD21_CLOCK_PLANNER_TC_MAX);
+
+            while (d <= SAMD21_CLOCK_PLANNER_GCLK_DIV_MAX && (n % d || n / d > SAMD21_CLOCK_PLANNER_PERIOD_MAX))
+                d++;
+
+            if (d > SAMD21_CLOCK_PLANNER_GCLK_DIV_MAX || n / d < 2)
+                continue;
+
+            candidate.generator = dpllGenerator;
+            candidate.dpll = true;
+            candidate.dpllRatio = m / 16 - 1;
+            candidate.dpllFraction = m % 16;
+            candidate.divider = d;
+            candidate.clock = (output + 8 * d) / (16 * d);
+            candidate.period = n / d;
+            candidate.ditherCount = 0;
+            candidate.ditherLength = 1;
+            candidate.error = error(output, 16 * (uint64_t) n, rate);
+
+            if (!found || better(candidate, plan))
+            {
+                plan = candidate;
+                found = true;
+            }
+
+            if (candidate.error == 0)
+                break;
+        }
+    }
+
+    return found ? DEVICE_OK : DEVICE_INVALID_PARAMETER;
+}
+
+/**
+ * Fills in the sequence of timer periods that dithers the sample period of a plan, with the longer periods spread
+ * evenly through the pattern. Each entry is the value of the timer's top (CC0) register, one less than the period.
+ *
+ * @param plan The plan.
+ * @param pattern An array of plan.ditherLength entries to fill in.
+ */
+void SAMD21ClockPlanner::fillDitherPattern(SAMD21ClockPlan &plan, uint16_t *pattern)
+{
+    uint32_t accumulator = 0;
+
+    for (uint32_t i = 0; i < plan.ditherLength; i++)
+    {
+        accumulator += plan.ditherCount;
+
+        if (accumulator >= plan.ditherLength)
+        {
+            accumulator -= plan.ditherLength;
+            pattern[i] = plan.period;
+        }
+        else
+        {
+            pattern[i] = plan.period - 1;
+        }
+    }
+}
@@ -24,8 +24,10 @@ DEALINGS IN THE SOFTWARE.
 
 #include "Timer.h"
 #include "Event.h"
+#include "CodalFiber.h"
 #include "CodalCompat.h"
 #include "SAMD21DAC.h"
+#include "codal_target_hal.h"
 
 #undef ENABLE
 
@@ -36,6 +38,47 @@ SAMD21DAC::SAMD21DAC(Pin &pin, SAMD21DMAC &dma, DataSource &source, int sampleRa
     this->active = false;
     this->dataReady = 0;
     this->sampleRate = sampleRate;
+    this->sampleRateError = 0;
+    this->ditherChannel = -1;
+    this->inputFormat = SAMD21DAC_FORMAT_NATIVE;
+    this->queueHead = 0;
+    this->queueTail = 0;
+    this->samplesQueued = 0;
+    this->samplesPlayed = 0;
+    this->underruns = 0;
+    this->lateRestarts = 0;
+    this->underrunPolicy = SAMD21DAC_UNDERRUN_HOLD;
+    this->starved = false;
+    this->silenceDescriptor = NULL;
+    this->silent = false;
+    this->toneState = SAMD21DAC_TONE_OFF;
+    this->toneCurrent = 0;
+    this->toneFrequency = 0;
+    this->toneDeadline = 0;
+    this->toneListening = false;
+    this->toneDescriptor[0] = NULL;
+    this->toneDescriptor[1] = NULL;
+    this->gain = SAMD21DAC_VOLUME_MAX << 14;
+    this->gainStep = 0;
+    this->gainStart = gain;
+    this->gainTarget = gain;
+    this->logStart = 0;
+    this->logTarget = 0;
+    this->rampLength = 0;
+    this->rampRemaining = 0;
+    this->segmentRemaining = 0;
+    this->rampShape = SAMD21DAC_RAMP_LINEAR;
+
+    // Prepare the buffers played when upstream data is late.
+    silence = ManagedBuffer(SAMD21DAC_FILL_SIZE * 2);
+    ramp = ManagedBuffer(SAMD21DAC_FILL_SIZE * 2);
+
+    for (int i = 0; i < SAMD21DAC_FILL_SIZE; i++)
+        ((uint16_t *) &silence[0])[i] = SAMD21DAC_MIDSCALE;
+
+    // Allocate our staging buffers up front, so that no heap allocation takes place during playback.
+    for (int i = 0; i < SAMD21DAC_QUEUE_SIZE; i++)
+        staging[i] = ManagedBuffer(SAMD21DAC_STAGING_SIZE * 2);
 
     // Register with our upstream component
     source.connect(*this);
@@ -122,6 +165,21 @@ SAMD21DAC::SAMD21DAC(Pin &pin, SAMD21DMAC &dma, DataSource &source, int sampleRa
         descriptor.DSTADDR.reg = (uint32_t) &DAC->DATA.reg;
         descriptor.DESCADDR.reg = 0;
 
+        // Allocate a descriptor for each slot in our queue. The last buffer queued always ends the chain, and is linked to
+        // the next as that is queued. If playback reaches the end of the chain first, the transfer ends, the DMAC disables
+        // the channel, and the channel is restarted from the next slot when a buffer is queued.
+        for (int i = 0; i < SAMD21DAC_QUEUE_SIZE; i++)
+        {
+            this->descriptor[i] = dmac.allocateDescriptor();
+
+            if (this->descriptor[i] == NULL)
+                target_panic(DEVICE_OOM);
+
+            this->descriptor[i]->BTCTRL.reg = descriptor.BTCTRL.reg;
+            this->descriptor[i]->DSTADDR.reg = descriptor.DSTADDR.reg;
+            dmac.linkDescriptor(*this->descriptor[i], NULL);
+        }
+
         DMAC->CHID.bit.ID = dmaChannel;             // Select our allocated channel
 
         DMAC->CHCTRLB.bit.CMD = 0;                  // No Command (yet)
@@ -143,35 +201,138 @@ SAMD21DAC::SAMD21DAC(Pin &pin, SAMD21DMAC &dma, DataSource &source, int sampleRa
 }
 
 /**
- * Change the DAC playback sample rate to the given frequency.
- * n.b. Only sample periods that are a multiple of 125nS are supported.
- * Frequencies mathcing other sample periods will be rounded down to the next lowest supported frequency.
+ * Determines the DAC playback sample rate.
  *
- * @param frequency The new sample playback frequency.
+ * @return the sample rate achieved, rounded to the nearest Hz.
  */
 int SAMD21DAC::getSampleRate()
 {
     return sampleRate;
 }
 
+/**
+ * Determines how far the sample rate achieved differs from that requested, relative to the system clocks.
+ *
+ * @return the error in parts per million, rounded to the nearest ppm. Positive if the rate is fast.
+ */
+int SAMD21DAC::getSampleRateError()
+{
+    return (sampleRateError + (sampleRateError < 0 ? -500 : 500)) / 1000;
+}
+
 /**
  * Change the DAC playback sample rate to the given frequency.
- * n.b. Only sample periods that are a multiple of 125nS are supported.
- * Frequencies mathcing other sample periods will be rounded to the next highest supported frequency.
+ * The sample clock is planned by SAMD21ClockPlanner, choosing between the main clock, the peripheral clock, and
+ * (if SAMD21DAC_DPLL_REFERENCE is set) the DPLL. Where the rate is not an exact division of any of these, the
+ * sample period is dithered by a second DMA channel, so that the long term average rate is exact, or as close as possible.
  *
  * @param frequency The new sample playback frequency.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the rate can't be generated.
  */
 int SAMD21DAC::setSampleRate(int frequency)
 {
-    uint32_t period = 8000000 / frequency;
-    sampleRate = 8000000 / period;
+    SAMD21ClockPlanner planner;
+    SAMD21ClockPlan plan;
+
+    if (frequency <= 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    planner.addSource(0x00, SAMD21DAC_MAIN_CLOCK);
+    planner.addSource(0x01, SAMD21DAC_PERIPHERAL_CLOCK);
+    planner.setDpll(SAMD21DAC_DPLL_REFERENCE, SAMD21DAC_DPLL_GCLK);
+
+    if (planner.plan(frequency, plan) != DEVICE_OK)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Dithering needs a DMA channel of its own. If none is available, settle for the best undithered plan.
+    if (plan.ditherLength > 1 && ditherChannel < 0)
+    {
+        ditherChannel = dmac.allocateChannel();
+
+        if (ditherChannel < 0)
+        {
+            ditherChannel = -1;
+            planner.setDitherLimit(1);
+            planner.plan(frequency, plan);
+        }
+    }
+
+    // Stop the timer, and any dithering, while the sample clock is reconfigured.
+    TC3->COUNT16.CTRLA.bit.ENABLE = 0;
+
+    if (ditherChannel >= 0)
+    {
+        DMAC->CHID.bit.ID = ditherChannel;
+        DMAC->CHCTRLA.bit.ENABLE = 0;
+        while(DMAC->CHCTRLA.bit.ENABLE);
+    }
 
-    TC3->COUNT16.CTRLA.bit.ENABLE = 0;      // Stop the timer
+    if (plan.dpll)
+    {
+        // Lock the DPLL to the required multiple of its reference, and feed it through our clock generator.
+        SYSCTRL->DPLLCTRLA.bit.ENABLE = 0;
+        SYSCTRL->DPLLRATIO.reg = plan.dpllFraction << 16 | plan.dpllRatio;
+        SYSCTRL->DPLLCTRLB.bit.REFCLK = SAMD21DAC_DPLL_REFCLK;
+        SYSCTRL->DPLLCTRLA.bit.ENABLE = 1;
+        while(!SYSCTRL->DPLLSTATUS.bit.LOCK || !SYSCTRL->DPLLSTATUS.bit.CLKRDY);
+
+        GCLK->GENDIV.reg = plan.divider << 8 | plan.generator;
+        while(GCLK->STATUS.bit.SYNCBUSY);
+
+        GCLK->GENCTRL.reg = 0x00030800 | plan.generator;    // FDPLL96M source, generator enabled, improved duty cycle.
+        while(GCLK->STATUS.bit.SYNCBUSY);
+    }
+
+    // Drive TC3 from the chosen clock generator.
+    GCLK->CLKCTRL.bit.ID = 0x1B;    // TC3 Clock
+    GCLK->CLKCTRL.bit.CLKEN = 0;
+    while(GCLK->CLKCTRL.bit.CLKEN);
+
+    GCLK->CLKCTRL.bit.GEN = plan.generator;
+    GCLK->CLKCTRL.bit.CLKEN = 1;    // Enable clock
+
+    // In match frequency mode, the timer counts from zero to CC0 inclusive.
+    TC3->COUNT16.CC[0].reg = plan.period - 1;
+
+    if (plan.ditherLength > 1)
+    {
+        // Cycle through the dither pattern, writing the period of the next sample to CC0 as each sample period ends.
+        // The new value is written just after the counter wraps, so is always above the count.
+        ditherPattern = ManagedBuffer(plan.ditherLength * 2);
+        SAMD21ClockPlanner::fillDitherPattern(plan, (uint16_t *) &ditherPattern[0]);
 
-    TC3->COUNT16.CC[0].reg = period;        // Set period
+        DmacDescriptor &descriptor = dmac.getDescriptor(ditherChannel);
+
+        descriptor.BTCTRL.reg = 0;
+        descriptor.BTCTRL.bit.SRCINC = 1;       // increment does apply to source address
+        descriptor.BTCTRL.bit.BEATSIZE = 1;     // 16 bit wide transfer.
+        descriptor.BTCTRL.bit.BLOCKACT = 0;     // No interrupt at the end of each pattern.
+        descriptor.BTCTRL.bit.VALID = 1;        // Enable the descritor
+
+        descriptor.BTCNT.bit.BTCNT = plan.ditherLength;
+        descriptor.SRCADDR.reg = ((uint32_t) &ditherPattern[0]) + plan.ditherLength * 2;
+        descriptor.DSTADDR.reg = (uint32_t) &TC3->COUNT16.CC[0].reg;
+        descriptor.DESCADDR.reg = (uint32_t) &descriptor;     // Loop the pattern indefinitely.
+
+        DMAC->CHID.bit.ID = ditherChannel;
+        DMAC->CHCTRLB.bit.CMD = 0;                  // No Command (yet)
+        DMAC->CHCTRLB.bit.TRIGACT = 2;              // One trigger per beat transfer
+        DMAC->CHCTRLB.bit.TRIGSRC = 0x18;           // TC3 overflow trigger
+        DMAC->CHCTRLB.bit.LVL = 1;                  // Above the DAC, so the period is always updated in good time.
+        DMAC->CHCTRLB.bit.EVIE = 0;
+        DMAC->CHCTRLA.bit.ENABLE = 1;
+    }
+    else
+    {
+        ditherPattern = ManagedBuffer();
+    }
 
     TC3->COUNT16.CTRLA.bit.ENABLE = 1;      // Restart the timer
 
+    sampleRateError = plan.error;
+    sampleRate = frequency + ((int64_t) frequency * plan.error + (plan.error < 0 ? -500000000 : 500000000)) / 1000000000;
+
     return DEVICE_OK;
 }
 
@@ -180,64 +341,897 @@ int SAMD21DAC::setSampleRate(int frequency)
  */
 int SAMD21DAC::pullRequest()
 {
+    target_disable_irq();
+
     dataReady++;
 
-    if (!active)
+    // Prefetch as many buffers as we have room for. Any others are pulled as queued buffers complete.
+    // Data is left waiting while a tone is playing.
+    while (dataReady && toneState == SAMD21DAC_TONE_OFF && queueTail - queueHead < SAMD21DAC_QUEUE_SIZE)
         pull();
 
+    target_enable_irq();
+
     return DEVICE_OK;
 }
 
 /**
- * Pull down a buffer from upstream, and schedule a DMA transfer from it.
+ * Pull down a buffer from upstream, and queue it for playback.
  */
 int SAMD21DAC::pull()
 {
-    output = upstream.pull();
+    ManagedBuffer b = upstream.pull();
     dataReady--;
 
     if (dmaChannel == DEVICE_NO_RESOURCES)
         return DEVICE_NO_RESOURCES;
-    
-    if (output.length() == 0) {
+
+    if (b.length() == 0) {
         dataReady = 0;
-        active = false;
         return DEVICE_OK;
     }
 
-    active = true;
+    starved = false;
+    return enqueue(b, &b[0], b.length(), inputFormat, true);
+}
+
+/**
+ * Converts samples to the DAC's native, unsigned 10 bit format.
+ *
+ * @param in The samples to convert.
+ * @param out The buffer to hold the converted samples.
+ * @param samples The number of samples to convert.
+ * @param format The format of the input samples, one of the SAMD21DAC_FORMAT_ values other than SAMD21DAC_FORMAT_NATIVE.
+ */
+static void convert(const uint8_t *in, uint16_t *out, int samples, int format)
+{
+    uint16_t *end = out + samples;
+
+    switch (format)
+    {
+        case SAMD21DAC_FORMAT_S16:
+            for (const int16_t *p = (const int16_t *) in; out < end; p++)
+                *out++ = (*p + 32768) >> 6;
+            break;
+
+        case SAMD21DAC_FORMAT_U16:
+            for (const uint16_t *p = (const uint16_t *) in; out < end; p++)
+                *out++ = *p >> 6;
+            break;
+
+        case SAMD21DAC_FORMAT_S8:
+            for (const int8_t *p = (const int8_t *) in; out < end; p++)
+                *out++ = (*p + 128) << 2;
+            break;
+
+        case SAMD21DAC_FORMAT_U8:
+            for (const uint8_t *p = in; out < end; p++)
+                *out++ = *p << 2;
+            break;
+    }
+}
+
+/**
+ * Computes log2 of a gain, using a quadratic approximation of the fractional part.
+ *
+ * @param gain A gain in Q24 format, greater than zero.
+ *
+ * @return log2 of the gain, in Q16 format (so unity gain gives 24 << 16).
+ */
+static int32_t gainToLog(int32_t gain)
+{
+    int msb = 31 - __builtin_clz(gain);
+    uint32_t x = ((uint32_t) gain << (31 - msb)) >> 15 & 0xFFFF;
+
+    // log2(1 + x) ~= x * (1.3465 - 0.3465 * x)
+    return (msb << 16) + ((x * ((88244 - ((22708 * x) >> 16)) >> 1)) >> 15);
+}
+
+/**
+ * Computes 2 raised to the given power, using a quadratic approximation of the fractional part. The inverse of gainToLog().
+ *
+ * @param log The power, in Q16 format.
+ *
+ * @return the gain, in Q24 format.
+ */
+static int32_t logToGain(int32_t log)
+{
+    uint32_t x = log & 0xFFFF;
+    int shift = (log >> 16) - 16;
+
+    // 2^x ~= 1 + x * (0.6565 + 0.3435 * x)
+    uint32_t m = 65536 + ((x * (43024 + ((22512 * x) >> 16))) >> 16);
+
+    return shift >= 0 ? m << shift : m >> -shift;
+}
+
+/**
+ * Converts samples to the DAC's native format, applying our volume and advancing any volume ramp in the same pass.
+ */
+void SAMD21DAC::scale(const uint8_t *in, uint16_t *out, int samples, int format)
+{
+    bool completed = false;
+
+    for (int i = 0; i < samples; i++)
+    {
+        int32_t v;
+
+        switch (format)
+        {
+            case SAMD21DAC_FORMAT_S16:
+                v = ((const int16_t *) in)[i];
+                break;
+
+            case SAMD21DAC_FORMAT_U16:
+                v = ((const uint16_t *) in)[i] - 32768;
+                break;
+
+            case SAMD21DAC_FORMAT_S8:
+                v = ((const int8_t *) in)[i] * 256;
+                break;
+
+            case SAMD21DAC_FORMAT_U8:
+                v = (in[i] - 128) * 256;
+                break;
+
+            default:
+                v = (((const uint16_t *) in)[i] - SAMD21DAC_MIDSCALE) * 64;
+                break;
+        }
+
+        if (rampRemaining)
+        {
+            // Compute the next point on the ramp, and the step needed to reach it.
+            if (segmentRemaining == 0)
+            {
+                segmentRemaining = min(rampRemaining, (uint32_t) SAMD21DAC_RAMP_SEGMENT);
+
+                uint32_t elapsed = rampLength - rampRemaining + segmentRemaining;
+                int32_t next = gainTarget;
+
+                if (elapsed < rampLength)
+                {
+                    if (rampShape == SAMD21DAC_RAMP_EXPONENTIAL)
+                        next = logToGain(logStart + (int64_t) (logTarget - logStart) * elapsed / rampLength);
+                    else
+                        next = gainStart + (int64_t) (gainTarget - gainStart) * elapsed / rampLength;
+                }
+
+                gainStep = (next - gain) / (int32_t) segmentRemaining;
+            }
+
+            gain += gainStep;
+            segmentRemaining--;
+
+            if (--rampRemaining == 0)
+            {
+                gain = gainTarget;
+                completed = true;
+            }
+        }
+
+        v = (v * (gain >> 8)) >> 16;
+        *out++ = (v + 32768) >> 6;
+    }
 
-    DmacDescriptor &descriptor = dmac.getDescriptor(dmaChannel);
+    if (completed)
+        Event(id, SAMD21DAC_EVT_RAMP_COMPLETE);
+}
 
-    descriptor.SRCADDR.reg = ((uint32_t) &output[0]) + (output.length());
-    descriptor.BTCNT.bit.BTCNT = output.length()/2;
+/**
+ * Starts the stopped DMA channel from the given descriptor. The channel always starts from its own descriptor,
+ * so that is loaded with a copy of the one given. Must be called with interrupts disabled, or from the DMA interrupt.
+ */
+void SAMD21DAC::startChannel(DmacDescriptor &d)
+{
+    DmacDescriptor &first = dmac.getDescriptor(dmaChannel);
+
+    first.BTCTRL.reg = d.BTCTRL.reg;
+    first.BTCNT.reg = d.BTCNT.reg;
+    first.SRCADDR.reg = d.SRCADDR.reg;
+    first.DSTADDR.reg = d.DSTADDR.reg;
+    first.DESCADDR.reg = d.DESCADDR.reg;
 
-    // Enable the DMA channel.
     DMAC->CHID.bit.ID = dmaChannel;
+    DMAC->CHINTFLAG.reg = DMAC_CHINTENCLR_TERR;
     DMAC->CHCTRLA.bit.ENABLE = 1;
+}
+
+/**
+ * Adds length bytes of data to the playback queue, converting it if necessary, and restarting the DMA channel if it has stopped.
+ * The owner, if not empty, is the buffer holding the data, and is retained until it has played.
+ * If scale is true, our volume is applied to the samples. Must be called with interrupts disabled, or from the DMA interrupt.
+ */
+int SAMD21DAC::enqueue(ManagedBuffer owner, const uint8_t *data, int length, int format, bool scale)
+{
+    if (queueTail - queueHead >= SAMD21DAC_QUEUE_SIZE)
+        return DEVICE_NO_RESOURCES;
+
+    int slot = queueTail % SAMD21DAC_QUEUE_SIZE;
+    DmacDescriptor &d = *descriptor[slot];
+    int samples = length / (format == SAMD21DAC_FORMAT_S8 || format == SAMD21DAC_FORMAT_U8 ? 1 : 2);
+
+    // Samples need only be scaled if we're at less than full volume, or part way through a ramp.
+    scale = scale && (gain != SAMD21DAC_VOLUME_MAX << 14 || rampRemaining);
+
+    if (format == SAMD21DAC_FORMAT_NATIVE && !scale)
+    {
+        queue[slot] = owner;
+    }
+    else
+    {
+        // Convert into this slot's staging buffer, which is free as the slot is not queued.
+        if (samples > SAMD21DAC_STAGING_SIZE)
+            return DEVICE_NO_RESOURCES;
+
+        if (scale)
+            this->scale(data, (uint16_t *) &staging[slot][0], samples, format);
+        else
+            convert(data, (uint16_t *) &staging[slot][0], samples, format);
+
+        queue[slot] = staging[slot];
+        data = &staging[slot][0];
+    }
+
+    d.SRCADDR.reg = ((uint32_t) data) + samples * 2;
+    d.BTCNT.bit.BTCNT = samples;
+    d.DESCADDR.reg = 0;
+
+    completion[slot] = 0;
+    samplesQueued += samples;
+    queueTail++;
+    active = true;
+
+    DMAC->CHID.bit.ID = dmaChannel;
+
+    // Link the previous buffer, which ended the chain, to this one. If the DMAC is playing it, its write-back copy is the
+    // only descriptor in use that ends the chain, so update that too.
+    if (queueTail - queueHead > 1)
+    {
+        DmacDescriptor &writeBack = dmac.getWriteBackDescriptor(dmaChannel);
+
+        descriptor[(queueTail - 2) % SAMD21DAC_QUEUE_SIZE]->DESCADDR.reg = (uint32_t) &d;
+
+        if (writeBack.DESCADDR.reg == 0)
+            writeBack.DESCADDR.reg = (uint32_t) &d;
+    }
+
+    // If silence is looping in place of the queue, follow its current block with this buffer. The DMAC fetches the next
+    // descriptor using the write-back copy of the current one, but may refetch the current one at any moment, so update both.
+    if (silent)
+    {
+        silenceDescriptor->DESCADDR.reg = (uint32_t) &d;
+        dmac.getWriteBackDescriptor(dmaChannel).DESCADDR.reg = (uint32_t) &d;
+        silent = false;
+    }
+
+    // If the channel has stopped (either idle, or having reached the end of the chain before this buffer was linked to it),
+    // restart it from this slot.
+    if (!DMAC->CHCTRLA.bit.ENABLE)
+    {
+        // If a previous buffer remains queued, the DMAC finished it and stopped before its completion interrupt could
+        // be handled, so this buffer arrived too late to follow on seamlessly.
+        if (queueTail - queueHead > 1)
+        {
+            underruns++;
+            lateRestarts++;
+        }
+
+        startChannel(d);
+    }
 
     return DEVICE_OK;
 }
 
-int SAMD21DAC::play(const uint16_t *buffer, int length)
+/**
+ * Queues the given samples for playback, after any buffers already queued. The samples are played in place where
+ * possible, so may be held in flash, and must remain valid until they have played. Completion can be detected by
+ * requesting an event, or by comparing getQueuedPosition() before this call with getPlaybackPosition().
+ * If the volume is below SAMD21DAC_VOLUME_MAX, the samples are scaled into a staging buffer as they are queued instead.
+ *
+ * Each buffer is played as a single DMA block, so may hold at most 65535 samples, or SAMD21DAC_STAGING_SIZE if it
+ * must be scaled into a staging buffer. Buffers play back to back, but a slot in the queue is only freed once the
+ * completion interrupt for its buffer has been handled. For playback without gaps, each buffer should therefore hold
+ * at least SAMD21DAC_FILL_SIZE samples (1.5ms at 44.1kHz), so that the next is queued before those already queued
+ * have played.
+ *
+ * @param buffer The samples to play, in SAMD21DAC_FORMAT_NATIVE format.
+ * @param length The number of samples, between 1 and 65535.
+ * @param event The value of an event to raise from this component once the samples have played, or zero for none.
+ * Values below SAMD21DAC_EVT_USER are reserved.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the length is out of range or the event value is reserved,
+ * DEVICE_NO_RESOURCES if the playback queue is full or the buffer is too long to stage, or DEVICE_BUSY if a tone is playing.
+ */
+int SAMD21DAC::play(const uint16_t *buffer, int length, uint16_t event)
 {
     if (dmaChannel == DEVICE_NO_RESOURCES)
         return DEVICE_NO_RESOURCES;
 
-    active = true;
+    if (buffer == NULL || length <= 0 || length > 65535 || (event && event < SAMD21DAC_EVT_USER))
+        return DEVICE_INVALID_PARAMETER;
+
+    int result = DEVICE_BUSY;
 
-    DmacDescriptor &descriptor = dmac.getDescriptor(dmaChannel);
+    target_disable_irq();
 
-    descriptor.SRCADDR.reg = ((uint32_t) buffer) + ((length) * 2);
-    descriptor.BTCNT.bit.BTCNT = length;
+    if (toneState == SAMD21DAC_TONE_OFF)
+    {
+        starved = false;
+        result = enqueue(ManagedBuffer(), (const uint8_t *) buffer, length * 2, SAMD21DAC_FORMAT_NATIVE, true);
 
-    // Enable our DMA channel.
+        // The completion interrupt for this slot can't be handled until interrupts are enabled again.
+        if (result == DEVICE_OK)
+            completion[(queueTail - 1) % SAMD21DAC_QUEUE_SIZE] = event;
+    }
+
+    target_enable_irq();
+
+    return result;
+}
+
+/**
+ * Determines how many buffers are queued for playback, including the one playing.
+ *
+ * @return the number of buffers queued, between zero and SAMD21DAC_QUEUE_SIZE.
+ */
+int SAMD21DAC::getQueueLength()
+{
+    return queueTail - queueHead;
+}
+
+/**
+ * Determines how far the DMAC has progressed through the playback queue. Must be called with interrupts disabled,
+ * or from the DMA interrupt.
+ *
+ * @param remaining Set to the number of samples yet to play from the buffer returned, if any.
+ *
+ * @return the queue position (counted as per queueHead) of the oldest buffer that has not finished playing,
+ * or queueTail if every queued buffer has played.
+ */
+uint32_t SAMD21DAC::findPlaying(uint32_t &remaining)
+{
+    DmacDescriptor &writeBack = dmac.getWriteBackDescriptor(dmaChannel);
+
+    remaining = 0;
     DMAC->CHID.bit.ID = dmaChannel;
-    DMAC->CHCTRLA.bit.ENABLE = 1;
+
+    // Once the channel has stopped, it has played every buffer queued.
+    if (!DMAC->CHCTRLA.bit.ENABLE)
+        return queueTail;
+
+    // The write-back descriptor holds a copy of the descriptor the DMAC is processing. A slot's descriptor is identified
+    // by its successor as well as its end address, as the same buffer may be queued in more than one slot.
+    for (uint32_t i = queueHead; i != queueTail; i++)
+    {
+        DmacDescriptor &d = *descriptor[i % SAMD21DAC_QUEUE_SIZE];
+
+        if (writeBack.SRCADDR.reg == d.SRCADDR.reg && writeBack.DESCADDR.reg == d.DESCADDR.reg)
+        {
+            // While the DMAC is busy with our channel, it holds the remaining beat count itself. Otherwise, the count
+            // was written back to the write-back descriptor when it last moved on to another channel. ACTIVE is read once,
+            // so that its fields are consistent.
+            uint32_t active = DMAC->ACTIVE.reg;
+
+            if ((active & DMAC_ACTIVE_ABUSY) && (active & DMAC_ACTIVE_ID_Msk) >> DMAC_ACTIVE_ID_Pos == (uint32_t) dmaChannel)
+                remaining = (active & DMAC_ACTIVE_BTCNT_Msk) >> DMAC_ACTIVE_BTCNT_Pos;
+            else
+                remaining = writeBack.BTCNT.bit.BTCNT;
+
+            remaining = min(remaining, (uint32_t) d.BTCNT.bit.BTCNT);
+
+            if (remaining)
+                return i;
+
+            // This buffer has played, and the DMAC is about to fetch the next.
+            i++;
+
+            if (i != queueTail)
+                remaining = descriptor[i % SAMD21DAC_QUEUE_SIZE]->BTCNT.bit.BTCNT;
+
+            return i;
+        }
+    }
+
+    // The DMAC has yet to start on the queue.
+    if (queueHead != queueTail)
+        remaining = descriptor[queueHead % SAMD21DAC_QUEUE_SIZE]->BTCNT.bit.BTCNT;
+
+    return queueHead;
+}
+
+/**
+ * Determines the playback position, as the number of samples played since this component was created.
+ * This includes ramps played on underrun, but not silence or tones.
+ *
+ * @return the number of samples played.
+ */
+uint32_t SAMD21DAC::getPlaybackPosition()
+{
+    target_disable_irq();
+
+    uint32_t position = samplesPlayed;
+
+    if (toneState == SAMD21DAC_TONE_OFF && queueHead != queueTail)
+    {
+        // Add the buffers that have played but are yet to be retired by the completion interrupt,
+        // and the progress through the buffer playing.
+        uint32_t remaining;
+        uint32_t playing = findPlaying(remaining);
+
+        for (uint32_t i = queueHead; i != playing; i++)
+            position += descriptor[i % SAMD21DAC_QUEUE_SIZE]->BTCNT.bit.BTCNT;
+
+        if (playing != queueTail)
+            position += descriptor[playing % SAMD21DAC_QUEUE_SIZE]->BTCNT.bit.BTCNT - remaining;
+    }
+
+    target_enable_irq();
+
+    return position;
+}
+
+/**
+ * Determines the playback position at which the next buffer queued will start to play, assuming no underrun.
+ *
+ * @return the number of samples queued since this component was created.
+ */
+uint32_t SAMD21DAC::getQueuedPosition()
+{
+    return samplesQueued;
+}
+
+/**
+ * Computes a sine, using a fifth order polynomial approximation, accurate to within 0.05% of full scale.
+ *
+ * @param phase The phase angle, where 65536 represents a full cycle.
+ *
+ * @return the sine of the given phase, in Q15 format.
+ */
+static int32_t sine(uint32_t phase)
+{
+    // Fold the phase into the first quadrant, as x in the range 0..1 in Q15 format.
+    int32_t x = (phase & 0x3FFF) << 1;
+
+    if (phase & 0x4000)
+        x = 32768 - x;
+
+    // sin(x * pi/2) ~= x * (a - x^2 * (b - c * x^2)), where a = pi/2, b = pi - 5/2 and c = pi/2 - 3/2.
+    int32_t x2 = (x * x) >> 15;
+    int32_t y = 51472 - ((x2 * (21023 - ((2320 * x2) >> 15))) >> 15);
+
+    y = (x * y) >> 15;
+
+    return (phase & 0x8000) ? -y : min(y, 32767);
+}
+
+/**
+ * Builds a table of whole cycles of the given waveform, and loops it in place of any tone already playing.
+ */
+int SAMD21DAC::startTone(int frequency, int amplitude, int waveform, const int16_t *cycle, int length, int duration)
+{
+    if (dmaChannel == DEVICE_NO_RESOURCES)
+        return DEVICE_NO_RESOURCES;
+
+    if (frequency <= 0 || frequency > sampleRate / 2 || amplitude < 0 || amplitude > 511 || duration < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Find the shortest table of whole cycles that reproduces the requested frequency within tolerance,
+    // or failing that, the most accurate table that fits.
+    uint32_t samples = 0;
+    uint32_t cycles = 0;
+    uint32_t error = 0;
+
+    for (uint32_t c = 1; ; c++)
+    {
+        uint32_t n = ((uint64_t) c * sampleRate + frequency / 2) / frequency;
+
+        if (n > SAMD21DAC_TONE_TABLE_MAX)
+            break;
+
+        int64_t difference = (int64_t) c * sampleRate - (int64_t) n * frequency;
+        uint32_t e = (uint64_t) (difference < 0 ? -difference : difference) * 1000000 / ((uint64_t) n * frequency);
+
+        if (samples == 0 || e < error)
+        {
+            samples = n;
+            cycles = c;
+            error = e;
+        }
+
+        if (error <= SAMD21DAC_TONE_TOLERANCE)
+            break;
+    }
+
+    if (samples == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Our tone descriptors are allocated on first use, as few are available.
+    for (int i = 0; i < 2; i++)
+    {
+        if (toneDescriptor[i] == NULL)
+        {
+            toneDescriptor[i] = dmac.allocateDescriptor();
+
+            if (toneDescriptor[i] == NULL)
+                return DEVICE_NO_RESOURCES;
+
+            toneDescriptor[i]->BTCTRL.reg = descriptor[0]->BTCTRL.reg;
+            toneDescriptor[i]->BTCTRL.bit.BLOCKACT = 0;     // No interrupt as each cycle completes.
+            toneDescriptor[i]->DSTADDR.reg = descriptor[0]->DSTADDR.reg;
+        }
+    }
+
+    // Prepare whichever table is not in use. If the last change has yet to take effect, the other table is still playing.
+    waitForTone();
+
+    if (toneState == SAMD21DAC_TONE_OFF && queueHead != queueTail)
+        return DEVICE_BUSY;
+
+    int next = toneState == SAMD21DAC_TONE_OFF ? toneCurrent : toneCurrent ^ 1;
+
+    if (toneTable[next].length() < (int) samples * 2)
+    {
+        toneTable[next] = ManagedBuffer(samples * 2);
+
+        if (toneTable[next].length() < (int) samples * 2)
+            return DEVICE_NO_RESOURCES;
+    }
+
+    uint16_t *out = (uint16_t *) &toneTable[next][0];
+
+    for (uint32_t i = 0; i < samples; i++)
+    {
+        uint32_t phase = (((uint64_t) i * cycles) << 16) / samples & 0xFFFF;
+        int32_t v;
+
+        if (cycle)
+            v = cycle[(phase * length) >> 16];
+        else if (waveform == SAMD21DAC_WAVE_SQUARE)
+            v = phase < 0x8000 ? 32767 : -32768;
+        else if (waveform == SAMD21DAC_WAVE_TRIANGLE)
+            v = phase < 0x4000 ? phase << 1 : phase < 0xC000 ? 32767 - ((phase - 0x4000) << 1) : ((phase - 0xC000) << 1) - 32768;
+        else if (waveform == SAMD21DAC_WAVE_SAWTOOTH)
+            v = (int32_t) phase - 32768;
+        else
+            v = sine(phase);
+
+        *out++ = SAMD21DAC_MIDSCALE + ((v * amplitude) >> 15);
+    }
+
+    // Loop the table with a descriptor linked to itself.
+    DmacDescriptor &d = *toneDescriptor[next];
+
+    d.SRCADDR.reg = ((uint32_t) &toneTable[next][0]) + samples * 2;
+    d.BTCNT.bit.BTCNT = samples;
+    d.DESCADDR.reg = (uint32_t) &d;
+    d.BTCTRL.bit.BLOCKACT = 0;
+    d.BTCTRL.bit.VALID = 1;
+
+    target_disable_irq();
+
+    // Queued playback may have started while the table was prepared.
+    if (toneState == SAMD21DAC_TONE_OFF && queueHead != queueTail)
+    {
+        target_enable_irq();
+        return DEVICE_BUSY;
+    }
+
+    DMAC->CHID.bit.ID = dmaChannel;
+
+    if (toneState == SAMD21DAC_TONE_PLAYING || silent)
+    {
+        // Redirect the channel to the new table at the end of the current cycle, or block of silence. The DMAC fetches the
+        // next descriptor using the write-back copy of the current one, but may refetch the current one at any moment,
+        // so update both.
+        DmacDescriptor &current = silent ? *silenceDescriptor : *toneDescriptor[toneCurrent];
+
+        current.DESCADDR.reg = (uint32_t) &d;
+        dmac.getWriteBackDescriptor(dmaChannel).DESCADDR.reg = (uint32_t) &d;
+        silent = false;
+    }
+    else if (DMAC->CHCTRLA.bit.ENABLE && queueTail)
+    {
+        // The DMAC is finishing the last buffer queued, so follow it with the new table, as enqueue() would.
+        descriptor[(queueTail - 1) % SAMD21DAC_QUEUE_SIZE]->DESCADDR.reg = (uint32_t) &d;
+        dmac.getWriteBackDescriptor(dmaChannel).DESCADDR.reg = (uint32_t) &d;
+    }
+
+    // If the channel is idle, having reached the end of the queue or of a stopping tone, start it from the new table.
+    if (!DMAC->CHCTRLA.bit.ENABLE)
+        startChannel(d);
+
+    toneCurrent = next;
+    toneState = SAMD21DAC_TONE_PLAYING;
+    toneFrequency = (cycles * sampleRate + samples / 2) / samples;
+    active = true;
+
+    target_enable_irq();
+
+    // Schedule the end of the tone. Any event scheduled for an earlier tone is ignored, as its deadline has moved.
+    toneDeadline = 0;
+
+    if (duration)
+    {
+        if (!toneListening && EventModel::defaultEventBus)
+        {
+            EventModel::defaultEventBus->listen(id, SAMD21DAC_EVT_TONE_TIMEOUT, this, &SAMD21DAC::onToneTimeout);
+            toneListening = true;
+        }
+
+        toneDeadline = system_timer_current_time() + duration;
+        system_timer_event_after_us(duration * 1000, id, SAMD21DAC_EVT_TONE_TIMEOUT);
+    }
 
     return DEVICE_OK;
 }
 
+/**
+ * Waits for the DMAC to move on to the most recently started tone table, or for a stopping tone to stop,
+ * if it has not already done so. This takes at most one cycle of the previous tone, so the calling fiber sleeps meanwhile.
+ */
+void SAMD21DAC::waitForTone()
+{
+    DmacDescriptor &writeBack = dmac.getWriteBackDescriptor(dmaChannel);
+
+    while (true)
+    {
+        target_disable_irq();
+        DMAC->CHID.bit.ID = dmaChannel;
+        bool pending = toneState == SAMD21DAC_TONE_STOPPING || (toneState == SAMD21DAC_TONE_PLAYING &&
+            DMAC->CHCTRLA.bit.ENABLE && writeBack.SRCADDR.reg != toneDescriptor[toneCurrent]->SRCADDR.reg);
+        target_enable_irq();
+
+        if (!pending)
+            return;
+
+        fiber_sleep(1);
+    }
+}
+
+/**
+ * Event handler, stopping the tone at the end of its duration.
+ */
+void SAMD21DAC::onToneTimeout(Event)
+{
+    if (toneDeadline && (long) (system_timer_current_time() - toneDeadline) >= 0)
+        stopTone();
+}
+
+/**
+ * Plays a continuous tone, looped from a table in memory by the DMA controller, so that the CPU is not involved once
+ * the tone has started. The table holds a whole number of cycles at the current sample rate, so the frequency played
+ * may differ very slightly from that requested (see getToneFrequency()). If a tone is already playing, the new one
+ * follows on at the end of its current cycle, so frequency, amplitude and duration may be changed without glitches.
+ *
+ * Tones take priority over queued playback: upstream data is left waiting until the tone stops, and play() is refused.
+ * A SAMD21DAC_EVT_TONE_COMPLETE event is raised when the tone stops.
+ *
+ * @param frequency The frequency of the tone, in Hz. At most half the sample rate, and at least the sample rate / SAMD21DAC_TONE_TABLE_MAX.
+ * @param amplitude The peak amplitude of the tone, in the range 0..511.
+ * @param waveform One of SAMD21DAC_WAVE_SINE, SAMD21DAC_WAVE_SQUARE, SAMD21DAC_WAVE_TRIANGLE or SAMD21DAC_WAVE_SAWTOOTH.
+ * @param duration The time in milliseconds to play the tone for, or zero to play until stopTone() is called.
+ * The tone stops at the first cycle boundary after this time has elapsed.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if any parameter is out of range, DEVICE_BUSY if
+ * queued buffers are playing, or DEVICE_NO_RESOURCES if DMA descriptors or memory for the table are not available.
+ */
+int SAMD21DAC::playTone(int frequency, int amplitude, int waveform, int duration)
+{
+    if (waveform < SAMD21DAC_WAVE_SINE || waveform > SAMD21DAC_WAVE_SAWTOOTH)
+        return DEVICE_INVALID_PARAMETER;
+
+    return startTone(frequency, amplitude, waveform, NULL, 0, duration);
+}
+
+/**
+ * Plays a continuous tone of an arbitrary waveform, as per playTone(). The given cycle is resampled into the tone table,
+ * so it need not match the tone's frequency, and need not be retained once this returns.
+ *
+ * @param cycle A single cycle of the waveform, as signed 16 bit samples.
+ * @param length The number of samples in the cycle.
+ * @param frequency The frequency of the tone, in Hz.
+ * @param amplitude The peak amplitude of the tone, in the range 0..511, corresponding to a full scale sample.
+ * @param duration The time in milliseconds to play the tone for, or zero to play until stopTone() is called.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if any parameter is out of range, DEVICE_BUSY if
+ * queued buffers are playing, or DEVICE_NO_RESOURCES if DMA descriptors or memory for the table are not available.
+ */
+int SAMD21DAC::playWaveform(const int16_t *cycle, int length, int frequency, int amplitude, int duration)
+{
+    if (cycle == NULL || length <= 0 || length > 65536)
+        return DEVICE_INVALID_PARAMETER;
+
+    return startTone(frequency, amplitude, 0, cycle, length, duration);
+}
+
+/**
+ * Stops the tone playing, at the end of its current cycle. Queued playback then resumes.
+ *
+ * @return DEVICE_OK.
+ */
+int SAMD21DAC::stopTone()
+{
+    target_disable_irq();
+
+    if (toneState == SAMD21DAC_TONE_PLAYING)
+    {
+        // End the transfer at the end of the current cycle, raising a transfer complete interrupt.
+        // If a change of tone is pending, the previous table's cycle is the last to play.
+        DmacDescriptor &writeBack = dmac.getWriteBackDescriptor(dmaChannel);
+
+        toneDescriptor[toneCurrent]->BTCTRL.bit.BLOCKACT = 1;
+        toneDescriptor[toneCurrent]->DESCADDR.reg = 0;
+        writeBack.BTCTRL.bit.BLOCKACT = 1;
+        writeBack.DESCADDR.reg = 0;
+        toneState = SAMD21DAC_TONE_STOPPING;
+    }
+
+    toneDeadline = 0;
+
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the frequency of the tone playing, which may differ slightly from that requested.
+ *
+ * @return the frequency in Hz, rounded to the nearest Hz, or zero if no tone is playing.
+ */
+int SAMD21DAC::getToneFrequency()
+{
+    return toneState == SAMD21DAC_TONE_PLAYING ? toneFrequency : 0;
+}
+
+/**
+ * Declares the format of samples provided by our upstream component.
+ * Samples are converted to the DAC's native format in a single pass as they are queued, so no separate
+ * conversion stage is needed. The default, SAMD21DAC_FORMAT_NATIVE, plays buffers directly without conversion.
+ *
+ * @param format One of SAMD21DAC_FORMAT_NATIVE, SAMD21DAC_FORMAT_S16, SAMD21DAC_FORMAT_U16,
+ * SAMD21DAC_FORMAT_S8 or SAMD21DAC_FORMAT_U8.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the format is not recognised.
+ */
+int SAMD21DAC::setInputFormat(int format)
+{
+    if (format < SAMD21DAC_FORMAT_NATIVE || format > SAMD21DAC_FORMAT_U8)
+        return DEVICE_INVALID_PARAMETER;
+
+    inputFormat = format;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the format of samples expected from our upstream component.
+ *
+ * @return One of the SAMD21DAC_FORMAT_ values.
+ */
+int SAMD21DAC::getInputFormat()
+{
+    return inputFormat;
+}
+
+/**
+ * Changes the volume of queued playback, either immediately or as a smooth ramp over the given time.
+ * The gain is applied to each sample as it is converted into a staging buffer, so ramps are sample accurate and
+ * need no extra pass over the data. As samples are converted when queued, changes are heard after any buffers
+ * already queued have played. Tones are not affected.
+ *
+ * A SAMD21DAC_EVT_RAMP_COMPLETE event is raised when the last sample of the ramp is queued.
+ * Any ramp in progress is replaced, starting from the current gain, so ramps may be changed without clicks.
+ *
+ * @param level The target level, in the range 0..SAMD21DAC_VOLUME_MAX. SAMD21DAC_VOLUME_MAX plays samples unaltered.
+ * @param duration The length of the ramp, in milliseconds, or zero to change the volume immediately.
+ * @param shape SAMD21DAC_RAMP_LINEAR or SAMD21DAC_RAMP_EXPONENTIAL. Exponential ramps sound more even to the
+ * ear, but start from or end at -60dB where the level is zero, before stepping to silence.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if any parameter is out of range.
+ */
+int SAMD21DAC::setVolume(int level, int duration, int shape)
+{
+    if (level < 0 || level > SAMD21DAC_VOLUME_MAX || duration < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (shape != SAMD21DAC_RAMP_LINEAR && shape != SAMD21DAC_RAMP_EXPONENTIAL)
+        return DEVICE_INVALID_PARAMETER;
+
+    uint32_t length = (uint64_t) duration * sampleRate / 1000;
+
+    target_disable_irq();
+
+    gainStart = gain;
+    gainTarget = level << 14;
+    rampShape = shape;
+    rampLength = length;
+    rampRemaining = length;
+    segmentRemaining = 0;
+
+    // Exponential ramps run between -60dB and full scale, in place of silence.
+    logStart = gainToLog(max(gainStart, SAMD21DAC_VOLUME_MAX << 4));
+    logTarget = gainToLog(max(gainTarget, SAMD21DAC_VOLUME_MAX << 4));
+
+    if (length == 0)
+        gain = gainTarget;
+
+    target_enable_irq();
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the volume of queued playback, which may be part way through a ramp.
+ *
+ * @return the level applied to the next sample queued, in the range 0..SAMD21DAC_VOLUME_MAX.
+ */
+int SAMD21DAC::getVolume()
+{
+    return (gain + (1 << 13)) >> 14;
+}
+
+/**
+ * Selects what is played when upstream data does not arrive in time, and the playback queue runs dry.
+ * Silence is looped by the DMAC outside the playback queue, so it raises no interrupts, and does not prevent
+ * a tone from starting. If silence is already playing, it continues until data is queued.
+ *
+ * @param policy One of SAMD21DAC_UNDERRUN_HOLD, SAMD21DAC_UNDERRUN_RAMP or SAMD21DAC_UNDERRUN_SILENCE.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the policy is not recognised, or DEVICE_NO_RESOURCES
+ * if a DMA descriptor is not available to loop silence.
+ */
+int SAMD21DAC::setUnderrunPolicy(int policy)
+{
+    if (policy != SAMD21DAC_UNDERRUN_HOLD && policy != SAMD21DAC_UNDERRUN_RAMP && policy != SAMD21DAC_UNDERRUN_SILENCE)
+        return DEVICE_INVALID_PARAMETER;
+
+    // Our silence descriptor is allocated on first use, as few are available.
+    if (policy == SAMD21DAC_UNDERRUN_SILENCE && silenceDescriptor == NULL)
+    {
+        if (dmaChannel == DEVICE_NO_RESOURCES)
+            return DEVICE_NO_RESOURCES;
+
+        silenceDescriptor = dmac.allocateDescriptor();
+
+        if (silenceDescriptor == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        silenceDescriptor->BTCTRL.reg = descriptor[0]->BTCTRL.reg;
+        silenceDescriptor->BTCTRL.bit.BLOCKACT = 0;     // No interrupt as each block of silence completes.
+        silenceDescriptor->BTCTRL.bit.VALID = 1;
+        silenceDescriptor->BTCNT.bit.BTCNT = SAMD21DAC_FILL_SIZE;
+        silenceDescriptor->SRCADDR.reg = ((uint32_t) &silence[0]) + SAMD21DAC_FILL_SIZE * 2;
+        silenceDescriptor->DSTADDR.reg = descriptor[0]->DSTADDR.reg;
+    }
+
+    underrunPolicy = policy;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines how often the DMA channel stopped between buffers because a buffer was queued a moment too late,
+ * after the DMAC had already finished the previous one. Each of these is also counted as an underrun.
+ *
+ * @return the number of late restarts since this component was created.
+ */
+uint32_t SAMD21DAC::getLateRestartCount()
+{
+    return lateRestarts;
+}
+
+/**
+ * Determines how often playback has run out of queued data. Each period of starvation is counted once,
+ * regardless of how long it lasts, or what is played meanwhile.
+ *
+ * @return the number of underruns since this component was created.
+ */
+uint32_t SAMD21DAC::getUnderrunCount()
+{
+    return underruns;
+}
+
 void SAMD21DAC::setValue(int value)
 {
     DAC->DATA.reg = value;
@@ -251,15 +1245,103 @@ int SAMD21DAC::getValue()
 extern void debug_flip();
 
 /**
- * Base implementation of a DMA callback
+ * Interrupt callback when playback of one or more queued buffers has completed.
+ * The DMAC has already moved on to the next queued buffer, if there is one.
  */
 void SAMD21DAC::dmaTransferComplete()
 {
-    if (dataReady == 0)
+    // Tones raise an interrupt only when they stop.
+    if (toneState != SAMD21DAC_TONE_OFF)
     {
-        active = false;
+        if (toneState == SAMD21DAC_TONE_STOPPING)
+        {
+            toneState = SAMD21DAC_TONE_OFF;
+            active = false;
+
+            Event(id, SAMD21DAC_EVT_TONE_COMPLETE);
+
+            // Resume queued playback, if data is waiting.
+            while (dataReady && queueTail - queueHead < SAMD21DAC_QUEUE_SIZE)
+                pull();
+        }
+
         return;
     }
 
-    pull();
+    // Completion interrupts coalesce if the DMAC finishes another buffer before this one is handled,
+    // so retire every buffer that has played rather than one per interrupt.
+    uint16_t events[SAMD21DAC_QUEUE_SIZE];
+    int eventCount = 0;
+    uint32_t remaining;
+    uint32_t playing = findPlaying(remaining);
+
+    while (queueHead != playing)
+    {
+        int slot = queueHead % SAMD21DAC_QUEUE_SIZE;
+
+        if (completion[slot])
+            events[eventCount++] = completion[slot];
+
+        // Release the buffer played, emptying its slot.
+        queue[slot] = ManagedBuffer();
+        samplesPlayed += descriptor[slot]->BTCNT.bit.BTCNT;
+        queueHead++;
+    }
+
+    // Refill the queue from upstream, if data is waiting.
+    while (dataReady && queueTail - queueHead < SAMD21DAC_QUEUE_SIZE)
+        pull();
+
+    // If the queue has run dry, play something in its place, according to our underrun policy.
+    if (queueHead == queueTail)
+    {
+        if (!starved)
+        {
+            starved = true;
+            underruns++;
+        }
+
+        if (underrunPolicy == SAMD21DAC_UNDERRUN_SILENCE && !silent)
+        {
+            // Loop silence outside the queue until data is queued. If the DMAC has yet to reach the end of the chain
+            // after the last buffer played, link silence to it, in both the descriptor and its write-back copy.
+            // Otherwise the transfer has ended, and the channel is restarted from the silence descriptor.
+            DmacDescriptor &last = *descriptor[(queueTail - 1) % SAMD21DAC_QUEUE_SIZE];
+
+            silenceDescriptor->DESCADDR.reg = (uint32_t) silenceDescriptor;
+            DMAC->CHID.bit.ID = dmaChannel;
+
+            if (DMAC->CHCTRLA.bit.ENABLE)
+            {
+                last.DESCADDR.reg = (uint32_t) silenceDescriptor;
+                dmac.getWriteBackDescriptor(dmaChannel).DESCADDR.reg = (uint32_t) silenceDescriptor;
+            }
+
+            if (!DMAC->CHCTRLA.bit.ENABLE)
+                startChannel(*silenceDescriptor);
+
+            silent = true;
+        }
+        else if (underrunPolicy == SAMD21DAC_UNDERRUN_RAMP)
+        {
+            int32_t last = DAC->DATA.reg;
+
+            if (last != SAMD21DAC_MIDSCALE)
+            {
+                uint16_t *p = (uint16_t *) &ramp[0];
+
+                for (int i = 1; i <= SAMD21DAC_FILL_SIZE; i++)
+                    *p++ = last + (SAMD21DAC_MIDSCALE - last) * i / SAMD21DAC_FILL_SIZE;
+
+                enqueue(ramp, &ramp[0], ramp.length(), SAMD21DAC_FORMAT_NATIVE, false);
+            }
+        }
+
+        if (queueHead == queueTail && !silent)
+            active = false;
+    }
+
+    // Notify any listeners that their buffers have played, now that the queue is topped up.
+    for (int i = 0; i < eventCount; i++)
+        Event(id, events[i]);
 }
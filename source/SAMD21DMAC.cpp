@@ -59,7 +59,8 @@ SAMD21DMAC::SAMD21DMAC()
         ptr++;
     descriptors = (DmacDescriptor*)ptr;
 
-    memclr(descriptors, sizeof(DmacDescriptor) * (DMA_DESCRIPTOR_COUNT * 2));
+    memclr(descriptors, sizeof(DmacDescriptor) * (DMA_DESCRIPTOR_COUNT * 2 + DMA_LINKED_DESCRIPTOR_COUNT));
+    linkedDescriptorsAllocated = 0;
 
     // Set up to DMA Controller
     this->disable();
@@ -107,6 +108,20 @@ DmacDescriptor& SAMD21DMAC::getDescriptor(int channel)
     return descriptors[0];
 }
 
+/**
+ * Provides the write-back descriptor for the given channel number. While the channel is busy, this holds a copy of
+ * the descriptor currently being processed. Its DESCADDR determines which descriptor is fetched when the current block
+ * completes, so it may be updated to redirect an active channel at the next block boundary.
+ * @return the write-back descriptor, matching a previously allocated channel.
+ */
+DmacDescriptor& SAMD21DMAC::getWriteBackDescriptor(int channel)
+{
+    if (channel < DMA_DESCRIPTOR_COUNT)
+        return descriptors[channel];
+
+    return descriptors[0];
+}
+
 /**
  * Allocates an unused DMA channel, if one is available.
  * @return a valid channel descriptor in the range 1..DMA_DESCRIPTOR_COUNT, or DEVICE_NO_RESOURCES otherwise.
@@ -125,6 +140,60 @@ int SAMD21DMAC::allocateChannel()
     return DEVICE_NO_RESOURCES;
 }
 
+/**
+ * Allocates a descriptor that can be added to a channel's descriptor chain, using linkDescriptor().
+ * @return a zeroed, suitably aligned descriptor, or NULL if none are available.
+ */
+DmacDescriptor* SAMD21DMAC::allocateDescriptor()
+{
+    for (int i=0; i<DMA_LINKED_DESCRIPTOR_COUNT; i++)
+    {
+        if (!(linkedDescriptorsAllocated & (1UL << i)))
+        {
+            linkedDescriptorsAllocated |= (1UL << i);
+
+            DmacDescriptor *descriptor = &descriptors[DMA_DESCRIPTOR_COUNT * 2 + i];
+            memclr(descriptor, sizeof(DmacDescriptor));
+            return descriptor;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Release a previously allocated linked descriptor.
+ * @param descriptor the descriptor to free.
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the descriptor was not allocated by allocateDescriptor().
+ */
+int SAMD21DMAC::freeDescriptor(DmacDescriptor *descriptor)
+{
+    int i = descriptor - &descriptors[DMA_DESCRIPTOR_COUNT * 2];
+
+    if (i < 0 || i >= DMA_LINKED_DESCRIPTOR_COUNT)
+        return DEVICE_INVALID_PARAMETER;
+
+    linkedDescriptorsAllocated &= ~(1UL << i);
+    return DEVICE_OK;
+}
+
+/**
+ * Links a descriptor to its successor, such that the DMAC moves directly on to the next block transfer
+ * when this one completes, without any CPU intervention.
+ * A block complete interrupt is raised at the end of each linked block. If it is not serviced before the next block
+ * completes, the interrupts coalesce, so DmaComponent::dmaTransferComplete() may be called once for several blocks.
+ * Use the write-back descriptor (see getWriteBackDescriptor()) to determine which block the channel is processing.
+ *
+ * @param descriptor the descriptor to update.
+ * @param next the descriptor to follow it, or NULL to end the transfer after this block.
+ * This may be a channel's own descriptor (see getDescriptor()), to form a circular chain.
+ */
+void SAMD21DMAC::linkDescriptor(DmacDescriptor &descriptor, DmacDescriptor *next)
+{
+    descriptor.BTCTRL.bit.BLOCKACT = 1;     // Raise an interrupt at the end of this block, and continue to the next (if any).
+    descriptor.DESCADDR.reg = (uint32_t) next;
+}
+
 /**
  * Registers a component to receive low level, hardware interrupt upon DMA transfer completion
  *
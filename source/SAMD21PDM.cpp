@@ -23,28 +23,35 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "Event.h"
+#include "Timer.h"
 #include "CodalCompat.h"
 #include "SAMD21PDM.h"
+#include "IntegerMath.h"
 #include "Pin.h"
+#include "codal_target_hal.h"
 
 #undef ENABLE
 
 /**
- * An 8 bit PDM lookup table, used to reduce processing time.
+ * The supported output sample rates, and the decimation filter designed for each.
+ * The decimation ratio keeps the PDM clock (sampleRate * decimation) within the 1-3.25MHz
+ * operating range of typical MEMS microphones. Rates with a decimation of 64 use the windowed sinc filter,
+ * others use a CIC filter, with as many stages as its 32 bit arithmetic allows.
  */
-const int8_t pdmDecode[256] = {
-#   define S(n) (2*(n)-8)
-#   define B2(n) S(n),  S(n+1),  S(n+1),  S(n+2)
-#   define B4(n) B2(n), B2(n+1), B2(n+1), B2(n+2)
-#   define B6(n) B4(n), B4(n+1), B4(n+1), B4(n+2)
-B6(0), B6(1), B6(1), B6(2)
+struct SAMD21PDMRate
+{
+    uint32_t    sampleRate;         // The output sample rate, in Hz.
+    uint16_t    decimation;         // The number of PDM samples per PCM sample.
+    uint8_t     stages;             // The number of CIC stages, or zero for the windowed sinc filter.
 };
 
-// a windowed sinc filter for 44 khz, 64 samples
-const uint16_t sincfilter[SAMD21_PDM_DECIMATION] = {0, 2, 9, 21, 39, 63, 94, 132, 179, 236, 302, 379, 467, 565, 674, 792, 920, 1055, 1196, 1341, 1487, 1633, 1776, 1913, 2042, 2159, 2263, 2352, 2422, 2474, 2506, 2516, 2506, 2474, 2422, 2352, 2263, 2159, 2042, 1913, 1776, 1633, 1487, 1341, 1196, 1055, 920, 792, 674, 565, 467, 379, 302, 236, 179, 132, 94, 63, 39, 21, 9, 2, 0, 0};
-
-// a manual loop-unroller!
-#define ADAPDM_REPEAT_LOOP_16(X) X X X X X X X X X X X X X X X X
+const SAMD21PDMRate pdmRates[] = {
+    {8000, 256, 3},
+    {16000, 128, 4},
+    {22050, 128, 4},
+    {32000, SINC_DECIMATOR_TAPS, 0},
+    {44100, SINC_DECIMATOR_TAPS, 0}
+};
 
 /**
  * Update our reference to a downstream component.
@@ -63,22 +70,73 @@ void SAMD21PDM::connect(DataSink& component)
  * @param sd The pin the PDM data input is connected to.
  * @param sck The pin the PDM clock is conected to.
  * @param dma The DMA controller to use for data transfer.
- * @param sampleRate the rate at which samples are generated in the output buffer (in Hz)
+ * @param sampleRate the rate at which samples are generated in the output buffer (in Hz).
+ * One of 8000, 16000, 22050, 32000 or 44100. Other values are rounded to the nearest of these.
+ * Defaults to 22050 Hz, which earlier versions requested as 22000 Hz.
  * @param id The id to use for the message bus when transmitting events.
+ * @param poolSize The number of PCM output buffers to preallocate (minimum 2).
+ * @param rawBufferSize The size of each RAW PDM buffer in the DMA ring, in bytes.
+ * Rounded up to a multiple of SAMD21_PDM_BUFFER_ALIGNMENT, and limited to SAMD21_PDM_BUFFER_SIZE_MAX.
+ * @param outputBufferSize The size of each PCM output buffer, in bytes.
+ * Rounded up to a multiple of SAMD21_PDM_OUTPUT_ALIGNMENT, and limited to SAMD21_PDM_OUTPUT_SIZE_MAX.
  */
-SAMD21PDM::SAMD21PDM(Pin &sd, Pin &sck, SAMD21DMAC &dma, int sampleRate, uint16_t id) : dmac(dma), output(*this)
+SAMD21PDM::SAMD21PDM(Pin &sd, Pin &sck, SAMD21DMAC &dma, int sampleRate, uint16_t id, int poolSize, int rawBufferSize, int outputBufferSize) : dmac(dma), output(*this)
 {
     this->id = id;
-    this->sampleRate = sampleRate;
-    this->clockRate = sampleRate*16;
     this->enabled = false;
-    this->outputBufferSize = 512;
 
-    this->pdmDataBuffer = NULL;
-    this->pdmReceiveBuffer = rawPDM1;
+    // Round our buffer sizes to hold a whole number of samples, in any filter and channel configuration.
+    rawBufferSize = min(max(rawBufferSize, 1), SAMD21_PDM_BUFFER_SIZE_MAX);
+    outputBufferSize = min(max(outputBufferSize, 1), SAMD21_PDM_OUTPUT_SIZE_MAX);
+    this->rawBufferSize = (rawBufferSize + SAMD21_PDM_BUFFER_ALIGNMENT - 1) & ~(SAMD21_PDM_BUFFER_ALIGNMENT - 1);
+    this->outputBufferSize = (outputBufferSize + SAMD21_PDM_OUTPUT_ALIGNMENT - 1) & ~(SAMD21_PDM_OUTPUT_ALIGNMENT - 1);
+    this->rawPDM = new uint8_t[this->rawBufferSize * SAMD21_PDM_BUFFER_COUNT];
+
+    this->decimation = SINC_DECIMATOR_TAPS;
+    this->filterStages = 0;
+    this->channelMode = SAMD21_PDM_MONO;
+    this->highPassShift = 0;
+    this->dcLevel[0] = 0;
+    this->dcLevel[1] = 0;
+    this->gain = SAMD21_PDM_UNITY_GAIN;
+    this->outputFormat = SAMD21_PDM_FORMAT_S16;
+    this->sampleSize = 2;
+    this->blockEnergy = 0;
+    this->blockCrossings = 0;
+    this->blockSamples = 0;
+    this->blockPeak = 0;
+    this->lastSample = 0;
+    this->vadMode = SAMD21_PDM_VAD_OFF;
+    this->speechActive = false;
+    setVoiceActivityDetection(SAMD21_PDM_VAD_OFF);
+    this->levelEnergy = 0;
+    this->levelPeak = 0;
+    this->levelLoud = false;
+    setSoundLevelThreshold(0, 0);
+    setSoundLevelWindow(SAMD21_PDM_LEVEL_OFF);
+
+    this->rawWritten = 0;
+    this->rawRead = 0;
+    this->overruns = 0;
+    this->interruptDecimation = false;
+    this->interruptBudget = SAMD21_PDM_INTERRUPT_BUDGET;
+    this->interruptDuration = 0;
+    this->interruptDurationMax = 0;
+    this->settleTime = 0;
+
+    // Allocate all of our output buffers up front, so that no heap allocation takes place during capture.
+    // The pool retains a reference to each, so they are never freed.
+    this->poolSize = poolSize < 2 ? 2 : poolSize;
+    this->poolExhausted = 0;
+    this->pool = new BufferData*[this->poolSize];
+
+    for (int i = 0; i < this->poolSize; i++)
+        pool[i] = ManagedBuffer(this->outputBufferSize).leakData();
 
-    buffer = ManagedBuffer(outputBufferSize);
-    out = (int16_t *) &buffer[0];
+    poolIdleReference = pool[0]->refCount;
+
+    buffer = allocateBuffer();
+    out = &buffer[0];
 
     output.setBlocking(false);
 
@@ -120,11 +178,30 @@ SAMD21PDM::SAMD21PDM(Pin &sd, Pin &sck, SAMD21DMAC &dma, int sampleRate, uint16_
         descriptor.BTCTRL.bit.EVOSEL = 3;       // Strobe events after every BEAT transfer
         descriptor.BTCTRL.bit.VALID = 1;        // Enable the descritor
 
-        descriptor.BTCNT.bit.BTCNT = 0;
+        descriptor.BTCNT.bit.BTCNT = this->rawBufferSize / 4;
         descriptor.SRCADDR.reg = (uint32_t) &I2S->DATA[1].reg;
-        descriptor.DSTADDR.reg = 0;
+        descriptor.DSTADDR.reg = ((uint32_t) rawPDM) + this->rawBufferSize;
         descriptor.DESCADDR.reg = 0;
 
+        // Build a circular chain of descriptors, one for each buffer in our ring, so that DMA runs continuously.
+        rawDescriptor[0] = &descriptor;
+
+        for (int i = 1; i < SAMD21_PDM_BUFFER_COUNT; i++)
+        {
+            rawDescriptor[i] = dmac.allocateDescriptor();
+
+            if (rawDescriptor[i] == NULL)
+                target_panic(DEVICE_OOM);
+
+            rawDescriptor[i]->BTCTRL.reg = descriptor.BTCTRL.reg;
+            rawDescriptor[i]->BTCNT.reg = descriptor.BTCNT.reg;
+            rawDescriptor[i]->SRCADDR.reg = descriptor.SRCADDR.reg;
+            rawDescriptor[i]->DSTADDR.reg = ((uint32_t) rawPDM) + (i + 1) * this->rawBufferSize;
+        }
+
+        for (int i = 0; i < SAMD21_PDM_BUFFER_COUNT; i++)
+            dmac.linkDescriptor(*rawDescriptor[i], rawDescriptor[(i + 1) % SAMD21_PDM_BUFFER_COUNT]);
+
         DMAC->CHID.bit.ID = dmaChannel;             // Select our allocated channel
 
         DMAC->CHCTRLB.bit.CMD = 0;                  // No Command (yet)
@@ -142,27 +219,38 @@ SAMD21PDM::SAMD21PDM(Pin &sd, Pin &sck, SAMD21DMAC &dma, int sampleRate, uint16_
 
     dmac.enable();
 
-    // Configure for DMA enabled, single channel PDM input.
-    int clockDivisor = 1;
-    uint32_t cs = 48000000;
-    while(cs >= this->clockRate && clockDivisor < 0x1f)
-    {
-        clockDivisor++;
-        cs = 48000000 / clockDivisor;
-    }
+    // Select the supported sample rate closest to that requested, and the filter designed for it.
+    const SAMD21PDMRate *rate = &pdmRates[0];
+    int bestError = -1;
 
-    // We want to run at least as fast as the requested speed, so scale up if needed.
-    if (cs <= this->clockRate)
+    for (uint32_t i = 0; i < sizeof(pdmRates) / sizeof(SAMD21PDMRate); i++)
     {
-        clockDivisor--;
-        cs = 48000000 / clockDivisor;
+        int error = sampleRate - (int)pdmRates[i].sampleRate;
+        if (error < 0)
+            error = -error;
+
+        if (bestError < 0 || error < bestError)
+        {
+            rate = &pdmRates[i];
+            bestError = error;
+        }
     }
 
+    // We run off the 48MHz clock, and generate the PDM clock using the I2S master clock divider.
+    uint32_t bitRate = rate->sampleRate * rate->decimation;
+    int clockDivisor = (48000000 + bitRate/2) / bitRate;
+
+    if (clockDivisor < 1)
+        clockDivisor = 1;
+
+    if (clockDivisor > 32)
+        clockDivisor = 32;
+
     // Record our actual clockRate, as it's useful for calculating sample window sizes etc.
-    this->clockRate = cs;
+    this->clockRate = 48000000 / clockDivisor;
 
     // Make sure if we change the clock rate we update the sample rate as well
-    this->sampleRate = clockRate/16;
+    setDecimation(rate->decimation, rate->stages);
 
     // Disable I2S module while we configure it...
     I2S->CTRLA.reg = 0x00;
@@ -181,13 +269,13 @@ SAMD21PDM::SAMD21PDM(Pin &sd, Pin &sck, SAMD21DMAC &dma, int sampleRate, uint16_
       0;
 
     clkctrl |= I2S_CLKCTRL_MCKOUTDIV(0);
-    clkctrl |= I2S_CLKCTRL_MCKDIV(0);
+    clkctrl |= I2S_CLKCTRL_MCKDIV(clockDivisor-1);
     clkctrl |= I2S_CLKCTRL_NBSLOTS(1);  // STEREO is '1' (subtract one from #)
     clkctrl |= I2S_CLKCTRL_FSWIDTH_SLOT;  // Frame Sync (FS) Pulse is 1 Slot width
     clkctrl |= I2S_CLKCTRL_SLOTSIZE_16;
 
     // Configure for a 32 bit wide receive, with a SCK clock generated from GCLK_I2S_0.
-    I2S->CLKCTRL[0].reg = clkctrl | ((clockDivisor-1) << 19);
+    I2S->CLKCTRL[0].reg = clkctrl;
 
     // Configure serializer for a 32 bit data word transferred in a single DMA operation, clocked by clock unit 0.
     // set BITREV to give us LSB first data
@@ -229,71 +317,876 @@ ManagedBuffer SAMD21PDM::pull()
 }
 
 
-void SAMD21PDM::decimate(Event)
+/**
+ * Acquires a buffer from the pool that is no longer referenced by any downstream component.
+ *
+ * @return a free buffer from the pool, or an empty buffer if all are in use.
+ */
+ManagedBuffer SAMD21PDM::allocateBuffer()
+{
+    for (int i = 0; i < poolSize; i++)
+    {
+        if (pool[i]->refCount == poolIdleReference)
+            return ManagedBuffer(pool[i]);
+    }
+
+    return ManagedBuffer();
+}
+
+/**
+ * Determines how often a complete PCM buffer was dropped because every buffer in the pool was still held downstream.
+ *
+ * @return the number of buffers dropped since this component was created.
+ */
+uint32_t SAMD21PDM::getPoolExhaustedCount()
+{
+    return poolExhausted;
+}
+
+/**
+ * Selects the decimation filter used to generate PCM samples from PDM data.
+ * The output sample rate scales inversely with the decimation ratio.
+ *
+ * @param decimation The number of PDM samples per PCM sample, a power of two between 16 and 256.
+ * @param stages The number of CIC stages to use (1..CIC_DECIMATOR_MAX_STAGES), or zero to use the windowed sinc filter.
+ * The windowed sinc filter only supports a decimation of SINC_DECIMATOR_TAPS.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the configuration is not supported.
+ */
+int SAMD21PDM::setDecimation(int decimation, int stages)
 {
-    uint32_t *b = (uint32_t *)pdmDataBuffer;
+    if (stages == 0)
+    {
+        if (decimation != SINC_DECIMATOR_TAPS)
+            return DEVICE_INVALID_PARAMETER;
+    }
+    else if (cic[0].configure(decimation, stages) != DEVICE_OK || cic[1].configure(decimation, stages) != DEVICE_OK)
+    {
+        return DEVICE_INVALID_PARAMETER;
+    }
+
+    this->decimation = decimation;
+    this->filterStages = stages;
+    this->sampleRate = clockRate / decimation;
+
+    // Rescale the sound level meter to the new buffer duration.
+    setSoundLevelWindow(levelWindow);
+
+    // Discard any partially complete buffer, and allow the new filter to settle.
+    out = &buffer[0];
+    restartSettling();
+
+    return DEVICE_OK;
+}
 
-    // Ensure we have a sane buffer
-    if (pdmDataBuffer == NULL)
+/**
+ * Selects the format of each sample in the output buffers. Samples are converted as they are decimated,
+ * so no additional pass over the data is required. The output buffer size is unchanged, so 8 bit formats
+ * hold twice as many samples per buffer (or the same number in half the memory), and Q31 half as many.
+ *
+ * @param format One of SAMD21_PDM_FORMAT_S16, SAMD21_PDM_FORMAT_S8, SAMD21_PDM_FORMAT_U8,
+ * SAMD21_PDM_FORMAT_ULAW or SAMD21_PDM_FORMAT_Q31.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the format is not recognised.
+ */
+int SAMD21PDM::setOutputFormat(int format)
+{
+    switch (format)
+    {
+        case SAMD21_PDM_FORMAT_S16:
+            sampleSize = 2;
+            break;
+
+        case SAMD21_PDM_FORMAT_S8:
+        case SAMD21_PDM_FORMAT_U8:
+        case SAMD21_PDM_FORMAT_ULAW:
+            sampleSize = 1;
+            break;
+
+        case SAMD21_PDM_FORMAT_Q31:
+            sampleSize = 4;
+            break;
+
+        default:
+            return DEVICE_INVALID_PARAMETER;
+    }
+
+    outputFormat = format;
+    setSoundLevelWindow(levelWindow);
+
+    // Discard any partially complete buffer, as its layout no longer matches.
+    out = &buffer[0];
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the format of each sample in the output buffers.
+ *
+ * @return One of the SAMD21_PDM_FORMAT_ values.
+ */
+int SAMD21PDM::getOutputFormat()
+{
+    return outputFormat;
+}
+
+/**
+ * Determines the number of samples per channel held in each output buffer.
+ */
+int SAMD21PDM::getBufferSamples()
+{
+    int channels = channelMode == SAMD21_PDM_MONO ? 1 : 2;
+
+    return outputBufferSize / (sampleSize * channels);
+}
+
+/**
+ * Encodes a 16 bit linear sample as 8 bit G.711 mu-law.
+ */
+static inline uint8_t ulaw(int32_t v)
+{
+    int sign = (v >> 8) & 0x80;
+    int exponent = 7;
+
+    if (sign)
+        v = -v;
+
+    if (v > 32635)
+        v = 32635;
+
+    v += 0x84;
+
+    for (int mask = 0x4000; !(v & mask) && exponent > 0; mask >>= 1)
+        exponent--;
+
+    return ~(sign | (exponent << 4) | ((v >> (exponent + 3)) & 0x0F));
+}
+
+/**
+ * Writes a sample to the output buffer in the selected output format.
+ *
+ * @param dst The location to write to.
+ * @param value The sample to write, as a 16 bit value with 8 additional fractional bits.
+ */
+inline void SAMD21PDM::store(uint8_t *dst, int32_t value)
+{
+    switch (outputFormat)
+    {
+        case SAMD21_PDM_FORMAT_S16:
+            *(int16_t *)dst = value >> 8;
+            break;
+
+        case SAMD21_PDM_FORMAT_S8:
+            *(int8_t *)dst = value >> 16;
+            break;
+
+        case SAMD21_PDM_FORMAT_U8:
+            *dst = (value >> 16) + 128;
+            break;
+
+        case SAMD21_PDM_FORMAT_ULAW:
+            *dst = ulaw(value >> 8);
+            break;
+
+        case SAMD21_PDM_FORMAT_Q31:
+            *(int32_t *)dst = (int32_t) ((uint32_t) value << 8);  // value may be negative, so shift it unsigned
+            break;
+    }
+}
+
+/**
+ * Selects whether one or both microphones are captured, and how their samples are laid out in each output buffer.
+ * Both channels are decimated in a single pass over the received PDM data.
+ *
+ * @param mode One of SAMD21_PDM_MONO, SAMD21_PDM_STEREO_INTERLEAVED or SAMD21_PDM_STEREO_PLANAR.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the mode is not recognised.
+ */
+int SAMD21PDM::setChannelMode(int mode)
+{
+    if (mode != SAMD21_PDM_MONO && mode != SAMD21_PDM_STEREO_INTERLEAVED && mode != SAMD21_PDM_STEREO_PLANAR)
+        return DEVICE_INVALID_PARAMETER;
+
+    channelMode = mode;
+    setSoundLevelWindow(levelWindow);
+
+    // Discard any partially complete buffer, as its layout no longer matches.
+    out = &buffer[0];
+
+    if (filterStages)
+    {
+        cic[0].reset();
+        cic[1].reset();
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Configures the DC blocking high pass filter applied to each sample as it is decimated.
+ * The -3dB point of the filter is approximately sampleRate / (2 * pi * 2^shift).
+ *
+ * @param shift The time constant of the filter, as a power of two samples (4..12), or zero to disable the filter.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the time constant is out of range.
+ */
+int SAMD21PDM::setHighPassFilter(int shift)
+{
+    if (shift != 0 && (shift < 4 || shift > 12))
+        return DEVICE_INVALID_PARAMETER;
+
+    highPassShift = shift;
+    dcLevel[0] = 0;
+    dcLevel[1] = 0;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Sets the digital gain applied to each sample as it is decimated, after high pass filtering.
+ * Samples that exceed the 16 bit output range are saturated.
+ *
+ * @param gain The gain, in 1/256ths (SAMD21_PDM_UNITY_GAIN is unity). Up to 64x (16384) is supported.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the gain is out of range.
+ */
+int SAMD21PDM::setGain(int gain)
+{
+    if (gain < 0 || gain > 64 * SAMD21_PDM_UNITY_GAIN)
+        return DEVICE_INVALID_PARAMETER;
+
+    this->gain = gain;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Configures voice activity detection. The short term energy and zero crossing rate of the left channel are
+ * computed as samples are decimated, and each completed output buffer is classified as voiced or quiet.
+ * SAMD21_PDM_SPEECH_START and SAMD21_PDM_SPEECH_END events are raised as speech starts and ends.
+ * For best results, enable the high pass filter to remove any DC offset. See setHighPassFilter().
+ *
+ * @param mode One of SAMD21_PDM_VAD_OFF, SAMD21_PDM_VAD_TAG or SAMD21_PDM_VAD_GATE.
+ * In SAMD21_PDM_VAD_GATE mode, buffers are only passed downstream while speech is active.
+ * @param threshold The RMS level (in 16 bit sample units) above which a buffer may be considered voiced.
+ * @param hangover The number of quiet buffers after the last voiced buffer before speech is considered to have ended.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the mode is not recognised.
+ */
+int SAMD21PDM::setVoiceActivityDetection(int mode, int threshold, int hangover)
+{
+    if (mode != SAMD21_PDM_VAD_OFF && mode != SAMD21_PDM_VAD_TAG && mode != SAMD21_PDM_VAD_GATE)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (threshold < 0 || threshold > 32767 || hangover < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    vadMode = mode;
+    vadThreshold = threshold * threshold;
+    vadHangover = hangover;
+    vadCountdown = 0;
+
+    if (speechActive)
+    {
+        speechActive = false;
+        Event(id, SAMD21_PDM_SPEECH_END);
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines if speech is currently detected, when voice activity detection is enabled.
+ *
+ * @return true if speech is active, false otherwise.
+ */
+bool SAMD21PDM::isSpeechActive()
+{
+    return speechActive;
+}
+
+/**
+ * Classifies the output buffer just completed as voiced or quiet, raising events as speech starts and ends.
+ *
+ * @return true if the buffer should be passed downstream, false if it should be suppressed.
+ */
+bool SAMD21PDM::updateVoiceActivity()
+{
+    uint32_t energy = blockSamples ? blockEnergy / blockSamples : 0;
+    bool voiced = energy >= vadThreshold && blockCrossings * SAMD21_PDM_VAD_ZCR_DIVISOR < blockSamples;
+
+    if (voiced)
+    {
+        vadCountdown = vadHangover;
+
+        if (!speechActive)
+        {
+            speechActive = true;
+            Event(id, SAMD21_PDM_SPEECH_START);
+        }
+    }
+    else if (speechActive)
+    {
+        if (vadCountdown)
+        {
+            vadCountdown--;
+        }
+        else
+        {
+            speechActive = false;
+            Event(id, SAMD21_PDM_SPEECH_END);
+        }
+    }
+
+    return speechActive || vadMode != SAMD21_PDM_VAD_GATE;
+}
+
+/**
+ * Configures the sound level meter. The energy and peak value of the left channel are accumulated as samples are
+ * decimated, and integrated over time with an exponential weighting.
+ *
+ * @param window The integration time in milliseconds, typically SAMD21_PDM_LEVEL_FAST or SAMD21_PDM_LEVEL_SLOW,
+ * or SAMD21_PDM_LEVEL_OFF to disable the sound level meter.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the window is negative.
+ */
+int SAMD21PDM::setSoundLevelWindow(int window)
+{
+    if (window < 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    levelWindow = window;
+    levelAlpha = 65536;
+
+    if (window)
+    {
+        // Weight each output buffer by its duration as a fraction of the integration time.
+        uint32_t bufferSamples = getBufferSamples();
+        uint32_t windowSamples = (uint32_t) sampleRate * window / 1000;
+
+        if (bufferSamples < windowSamples)
+            levelAlpha = (bufferSamples << 16) / windowSamples;
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Configures the sound levels at which events are raised. A SAMD21_PDM_LEVEL_THRESHOLD_HIGH event is raised when
+ * the sound level rises above the high threshold, and a SAMD21_PDM_LEVEL_THRESHOLD_LOW event is raised when it then
+ * falls below the low threshold.
+ *
+ * @param low The RMS level (in 16 bit sample units) below which the sound is considered quiet, or zero to disable.
+ * @param high The RMS level (in 16 bit sample units) above which the sound is considered loud, or zero to disable.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if the thresholds are out of range.
+ */
+int SAMD21PDM::setSoundLevelThreshold(int low, int high)
+{
+    if (low < 0 || high < 0 || low > 32767 || high > 32767 || (low && high && low > high))
+        return DEVICE_INVALID_PARAMETER;
+
+    levelLow = low * low;
+    levelHigh = high * high;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Determines the current RMS sound level, as integrated by the sound level meter.
+ *
+ * @return the RMS level in 16 bit sample units (0..32767).
+ */
+int SAMD21PDM::getSoundLevel()
+{
+    return isqrt(levelEnergy);
+}
+
+/**
+ * Determines the current peak sound level. The peak level decays at the rate set by setSoundLevelWindow().
+ *
+ * @return the peak absolute sample value in 16 bit sample units (0..32767).
+ */
+int SAMD21PDM::getPeakLevel()
+{
+    return levelPeak;
+}
+
+/**
+ * Determines the current RMS sound level, relative to a full scale square wave.
+ *
+ * @return the sound level in dBFS, between -96 (silence) and 0.
+ */
+int SAMD21PDM::getSoundLevelDb()
+{
+    uint32_t energy = levelEnergy;
+
+    if (energy == 0)
+        return -96;
+
+    // 10 * log10(energy / 2^30), using a piecewise linear approximation of log2 in 1/256ths.
+    int msb = 31;
+    while (!(energy & (1UL << msb)))
+        msb--;
+
+    int fraction = msb >= 8 ? (energy >> (msb - 8)) & 0xFF : (energy << (8 - msb)) & 0xFF;
+    int log2 = (msb - 30) * 256 + fraction;
+
+    // 10 * log10(2) = 3.0103, or 771 in 1/256ths.
+    int db = (log2 * 771 - 32768) / 65536;
+
+    return db < -96 ? -96 : db;
+}
+
+/**
+ * Integrates the statistics of the output buffer just completed into the sound level meter, raising events as
+ * thresholds are crossed.
+ */
+void SAMD21PDM::updateSoundLevel()
+{
+    uint32_t energy = blockSamples ? blockEnergy / blockSamples : 0;
+
+    if (energy > levelEnergy)
+        levelEnergy += ((uint64_t)(energy - levelEnergy) * levelAlpha) >> 16;
+    else
+        levelEnergy -= ((uint64_t)(levelEnergy - energy) * levelAlpha) >> 16;
+
+    levelPeak -= ((uint64_t)levelPeak * levelAlpha) >> 16;
+    if ((uint32_t)blockPeak > levelPeak)
+        levelPeak = blockPeak;
+
+    if (levelHigh && !levelLoud && levelEnergy > levelHigh)
+    {
+        levelLoud = true;
+        Event(id, SAMD21_PDM_LEVEL_THRESHOLD_HIGH);
+    }
+
+    if (levelLow && levelLoud && levelEnergy < levelLow)
+    {
+        levelLoud = false;
+        Event(id, SAMD21_PDM_LEVEL_THRESHOLD_LOW);
+    }
+}
+
+/**
+ * Determines the rate at which PCM samples are generated.
+ *
+ * @return the output sample rate, in Hz.
+ */
+int SAMD21PDM::getSampleRate()
+{
+    return sampleRate;
+}
+
+/**
+ * Determines the rate at which PDM data is received from the microphone. The PDM clock is derived from 48MHz
+ * by an integer divisor, so the output sample rate is rarely a whole number of Hz. It is (to within 1ppm)
+ * getClockRate() / getDecimation(), which can be used to configure a PCMResampler for an exact output rate.
+ *
+ * @return the PDM clock rate, in Hz.
+ */
+uint32_t SAMD21PDM::getClockRate()
+{
+    return clockRate;
+}
+
+/**
+ * Determines the number of PDM samples per PCM sample of the current decimation filter.
+ *
+ * @return the decimation ratio.
+ */
+int SAMD21PDM::getDecimation()
+{
+    return decimation;
+}
+
+/**
+ * Determines how many RAW PDM buffers have been dropped because decimation fell behind and the DMA ring was full.
+ * Each dropped buffer represents a gap of (getRawBufferSize() * 4 / decimation) samples in the output.
+ *
+ * @return the number of buffers dropped since this component was created.
+ */
+uint32_t SAMD21PDM::getOverrunCount()
+{
+    return overruns;
+}
+
+/**
+ * Determines how long the output took to settle after the microphone was last enabled, or the decimation
+ * filter last changed. Samples are discarded until the output converges, up to SAMD21_PDM_SETTLE_TIMEOUT.
+ *
+ * @return the settling time, in microseconds.
+ */
+int SAMD21PDM::getSettleTime()
+{
+    return (uint64_t) settleTime * 1000000 / sampleRate;
+}
+
+/**
+ * Begins discarding output until the microphone and decimation filters have settled.
+ */
+void SAMD21PDM::restartSettling()
+{
+    settleSum = 0;
+    settleEnergy = 0;
+    settleCount = 0;
+    settleWindows = 0;
+    settleMean = 0;
+    settleElapsed = 0;
+    invalid = sampleRate * SAMD21_PDM_SETTLE_TIMEOUT / 1000 + 1;
+}
+
+/**
+ * Records a sample produced while settling, and determines if the output has converged.
+ *
+ * @param sample The (left channel) output sample.
+ *
+ * @return true if the output is now valid, false if the sample should be discarded.
+ */
+bool SAMD21PDM::settle(int32_t sample)
+{
+    settleSum += sample;
+    settleEnergy += (uint32_t)(sample * sample) >> SAMD21_PDM_SETTLE_WINDOW_SHIFT;
+    settleElapsed++;
+    invalid--;
+
+    if (++settleCount == 1 << SAMD21_PDM_SETTLE_WINDOW_SHIFT)
+    {
+        int32_t mean = settleSum >> SAMD21_PDM_SETTLE_WINDOW_SHIFT;
+        int32_t drift = mean > settleMean ? mean - settleMean : settleMean - mean;
+        int32_t variance = (int32_t) settleEnergy - mean * mean;
+
+        if (settleWindows && drift < SAMD21_PDM_SETTLE_DRIFT && variance < SAMD21_PDM_SETTLE_LEVEL * SAMD21_PDM_SETTLE_LEVEL)
+            invalid = 0;
+
+        settleMean = mean;
+        settleWindows++;
+        settleSum = 0;
+        settleEnergy = 0;
+        settleCount = 0;
+    }
+
+    if (invalid)
+        return false;
+
+    settleTime = settleElapsed;
+    return true;
+}
+
+/**
+ * Determines the size of each RAW PDM buffer in the DMA ring.
+ *
+ * @return the RAW buffer size, in bytes.
+ */
+int SAMD21PDM::getRawBufferSize()
+{
+    return rawBufferSize;
+}
+
+/**
+ * Determines the size of each PCM output buffer.
+ *
+ * @return the output buffer size, in bytes.
+ */
+int SAMD21PDM::getOutputBufferSize()
+{
+    return outputBufferSize;
+}
+
+/**
+ * Determines the worst case delay between a sound reaching the microphone and the PCM sample representing it
+ * being passed downstream. This is the time taken to fill one RAW buffer and one output buffer, and excludes
+ * any decimation delay if the CPU falls behind.
+ *
+ * @return the latency, in microseconds.
+ */
+int SAMD21PDM::getLatency()
+{
+    uint32_t samples = rawBufferSize * 4 / decimation + getBufferSamples();
+
+    return (uint64_t) samples * 1000000 / sampleRate;
+}
+
+/**
+ * Selects whether PDM data is decimated directly in the DMA interrupt, or deferred to the message bus (the default).
+ * Decimating in interrupt context minimises the latency between the microphone and downstream components,
+ * which are then also called in interrupt context. If decimation falls behind, any buffers remaining when the
+ * budget is exhausted are processed by the next interrupt.
+ *
+ * @param enable true to decimate in interrupt context, false to decimate via the message bus.
+ * @param budget The maximum time to spend decimating within a single interrupt, in microseconds.
+ * At least one buffer is always processed.
+ */
+void SAMD21PDM::setInterruptDecimation(bool enable, int budget)
+{
+    interruptBudget = budget;
+    interruptDecimation = enable;
+
+    // Hand any buffers left over by the interrupt back to the message bus.
+    if (!enable && rawRead != rawWritten)
+        Event(id, SAMD21_PDM_DATA_READY);
+}
+
+/**
+ * Determines the time spent in the most recent DMA interrupt, when decimating in interrupt context.
+ *
+ * @return the duration of the last interrupt, in microseconds.
+ */
+int SAMD21PDM::getInterruptDuration()
+{
+    return interruptDuration;
+}
+
+/**
+ * Determines the longest time spent in any DMA interrupt, when decimating in interrupt context.
+ *
+ * @return the longest interrupt duration observed, in microseconds.
+ */
+int SAMD21PDM::getMaxInterruptDuration()
+{
+    return interruptDurationMax;
+}
+
+/**
+ * Decimate all RAW buffers that are ready for processing, oldest first.
+ */
+void SAMD21PDM::decimate(Event)
+{
+    // If we're decimating in interrupt context, the interrupt owns the ring.
+    if (interruptDecimation)
         return;
 
-    while(b !=  (uint32_t *)((uint8_t *)pdmDataBuffer + SAMD21_PDM_BUFFER_SIZE)){
-        runningSum = 0;
-        sincPtr = sincfilter;
-
-        for (uint8_t samplenum=0; samplenum < (SAMD21_PDM_DECIMATION/16) ; samplenum++) {
-             uint16_t sample = *b++ & 0xFFFF;    // we read 16 bits at a time, by default the low half
-
-             ADAPDM_REPEAT_LOOP_16(      // manually unroll loop: for (int8_t b=0; b<16; b++) 
-               {
-                 // start at the LSB which is the 'first' bit to come down the line, chronologically 
-                 // (Note we had to set I2S_SERCTRL_BITREV to get this to work, but saves us time!)
-                 if (sample & 0x1) {
-                   runningSum += *sincPtr;     // do the convolution
-                 }
-                 sincPtr++;
-                 sample >>= 1;
-              }
-            )
+    while (rawRead != rawWritten)
+        decimateNext();
+}
+
+/**
+ * Decimate the oldest RAW buffer that is ready for processing.
+ */
+void SAMD21PDM::decimateNext()
+{
+    uint32_t written = rawWritten;
+
+    // If we've fallen too far behind, DMA has already started to overwrite the oldest buffers. Skip over them.
+    if (written - rawRead > SAMD21_PDM_BUFFER_COUNT - 1)
+    {
+        overruns += written - rawRead - (SAMD21_PDM_BUFFER_COUNT - 1);
+        rawRead = written - (SAMD21_PDM_BUFFER_COUNT - 1);
+    }
+
+    decimateBuffer(rawPDM + (rawRead % SAMD21_PDM_BUFFER_COUNT) * rawBufferSize);
+
+    // If DMA reached this buffer before we finished with it, part of it was overwritten before it was read.
+    if (rawWritten - rawRead > SAMD21_PDM_BUFFER_COUNT - 1 || getFillingBuffer() == (int)(rawRead % SAMD21_PDM_BUFFER_COUNT))
+        overruns++;
+
+    rawRead++;
+}
+
+/**
+ * Determines which buffer in the ring DMA is currently filling, from the write-back descriptor.
+ *
+ * @return the index of the buffer in the ring, or rawWritten's position in the ring if DMA has not yet started.
+ */
+int SAMD21PDM::getFillingBuffer()
+{
+    // Each descriptor's DSTADDR holds the end address of its buffer, as DSTINC is set.
+    uint32_t end = dmac.getWriteBackDescriptor(dmaChannel).DSTADDR.reg - (uint32_t) rawPDM;
+
+    if (end < rawBufferSize || end > rawBufferSize * SAMD21_PDM_BUFFER_COUNT)
+        return rawWritten % SAMD21_PDM_BUFFER_COUNT;
+
+    return end / rawBufferSize - 1;
+}
+
+/**
+ * Convert a single RAW buffer of PDM data into PCM samples, passing on any output buffers that are completed.
+ *
+ * @param data A buffer of rawBufferSize bytes of PDM data.
+ */
+void SAMD21PDM::decimateBuffer(uint8_t *data)
+{
+    uint32_t *b = (uint32_t *)data;
+    bool stereo = channelMode != SAMD21_PDM_MONO;
+
+    // In planar mode, right channel samples are written half a buffer ahead of the left.
+    int planarOffset = channelMode == SAMD21_PDM_STEREO_PLANAR ? outputBufferSize / 2 : 0;
+    uint8_t *end = &buffer[0] + outputBufferSize - planarOffset;
+
+    while(b !=  (uint32_t *)(data + rawBufferSize)){
+        int32_t sample[2] = {0, 0};
+        int32_t precise[2] = {0, 0};
+
+        if (filterStages)
+        {
+            for (int i = 0; i < decimation/16; i++)
+            {
+                uint32_t word = *b++;           // the low half word holds the left channel, the high half word the right
+
+                cic[0].integrate(word & 0xFFFF);
+
+                if (stereo)
+                    cic[1].integrate(word >> 16);
+            }
+
+            sample[0] = cic[0].decimate();
+
+            if (stereo)
+                sample[1] = cic[1].decimate();
+        }
+        else
+        {
+            SincDecimator::decimate(b, sample[0], sample[1], stereo);
+            b += SINC_DECIMATOR_TAPS/16;
         }
-        *out++ = runningSum - (1<<15);
 
-        // If our output buffer is full, schedule it to flow downstream.
-        if (out == (int16_t *) (&buffer[0] + outputBufferSize))
+        // Remove any DC offset and apply our gain, saturating to 16 bits, before the samples are stored.
+        // The fractional bits of the gain stage are retained for output formats wider than 16 bits.
+        for (int c = 0; c < (stereo ? 2 : 1); c++)
         {
-            if (invalid)
+            int32_t v = sample[c];
+
+            if (highPassShift)
             {
-                invalid--;
+                dcLevel[c] += v - (dcLevel[c] >> highPassShift);
+                v -= dcLevel[c] >> highPassShift;
             }
-            else
+
+            v *= gain;
+
+            if (v > 0x7FFFFF)
+                v = 0x7FFFFF;
+
+            if (v < -0x800000)
+                v = -0x800000;
+
+            precise[c] = v;
+            sample[c] = v >> 8;
+        }
+
+        // Discard samples until the microphone and filters have settled, then start a fresh buffer with the first valid sample.
+        if (invalid)
+        {
+            if (!settle(sample[0]))
+                continue;
+
+            out = &buffer[0];
+            blockEnergy = 0;
+            blockCrossings = 0;
+            blockSamples = 0;
+            blockPeak = 0;
+        }
+
+        // Accumulate the short term statistics of the left channel.
+        if (vadMode != SAMD21_PDM_VAD_OFF || levelWindow)
+        {
+            int32_t magnitude = sample[0] < 0 ? -sample[0] : sample[0];
+
+            blockEnergy += (uint32_t)(sample[0] * sample[0]);
+
+            if (magnitude > blockPeak)
+                blockPeak = magnitude;
+
+            if ((sample[0] ^ lastSample) < 0)
+                blockCrossings++;
+
+            lastSample = sample[0];
+            blockSamples++;
+        }
+
+        if (planarOffset)
+            store(out + planarOffset, precise[1]);
+
+        store(out, precise[0]);
+        out += sampleSize;
+
+        if (channelMode == SAMD21_PDM_STEREO_INTERLEAVED)
+        {
+            store(out, precise[1]);
+            out += sampleSize;
+        }
+
+        // If our output buffer is full, schedule it to flow downstream.
+        if (out == end)
+        {
+            bool valid = true;
+
+            if (levelWindow)
+                updateSoundLevel();
+
+            if (vadMode != SAMD21_PDM_VAD_OFF)
+                valid = updateVoiceActivity();
+
+            blockEnergy = 0;
+            blockCrossings = 0;
+            blockSamples = 0;
+            blockPeak = 0;
+
+            if (valid)
             {
-                output.pullRequest();
-                buffer = ManagedBuffer(outputBufferSize);
+                // Only pass this buffer downstream if we have another to fill. Otherwise, drop its contents and reuse it.
+                ManagedBuffer next = allocateBuffer();
+
+                if (next.length())
+                {
+                    output.pullRequest();
+                    buffer = next;
+                    end = &buffer[0] + outputBufferSize - planarOffset;
+                }
+                else
+                {
+                    poolExhausted++;
+                }
             }
 
-            out = (int16_t *) &buffer[0];
+            out = &buffer[0];
         }
     }
-
-    // Record that we've completed processing.
-    pdmDataBuffer = NULL;
 }
 
 void SAMD21PDM::dmaTransferComplete()
 {
-    // If the last puffer has already been processed, start processing this buffer.
-    // otherwise, we're running behind for some reason, so drop this buffer.
-    if (pdmDataBuffer == NULL)
+    // DMA has already moved on to the next buffer in the ring. Interrupts coalesce if they are serviced late,
+    // so queue every buffer completed since the last interrupt, up to the one now being filled.
+    uint32_t completed = (getFillingBuffer() + SAMD21_PDM_BUFFER_COUNT - rawWritten % SAMD21_PDM_BUFFER_COUNT) % SAMD21_PDM_BUFFER_COUNT;
+
+    // A block may complete during a previous interrupt, and be counted there.
+    if (completed == 0)
     {
-        pdmDataBuffer = pdmReceiveBuffer;
-        Event(id, SAMD21_PDM_DATA_READY);
+        if (!enabled)
+            DMAC->CHCTRLA.bit.ENABLE = 0;
 
-        pdmReceiveBuffer = pdmReceiveBuffer == rawPDM1 ? rawPDM2 : rawPDM1;
+        return;
     }
 
-    // start the next DMA transfer, unless we've been asked to stop.
-    if (enabled)
-        startDMA();
+    rawWritten += completed;
+
+    if (interruptDecimation)
+    {
+        // Decimate immediately, for as long as our budget allows. Anything left over waits for the next interrupt.
+        uint32_t start = system_timer_current_time_us();
+        uint32_t elapsed;
+
+        do
+        {
+            decimateNext();
+            elapsed = system_timer_current_time_us() - start;
+        } while (rawRead != rawWritten && elapsed < interruptBudget);
+
+        interruptDuration = elapsed;
+
+        if (elapsed > interruptDurationMax)
+            interruptDurationMax = elapsed;
+    }
+    else if (rawWritten - rawRead == completed)
+    {
+        // Only schedule decimation if it isn't already pending: it processes every buffer that is ready.
+        Event(id, SAMD21_PDM_DATA_READY);
+    }
+
+    // stop the DMA transfers if we've been asked to.
+    if (!enabled)
+        DMAC->CHCTRLA.bit.ENABLE = 0;
 }
 
 /**
@@ -307,7 +1200,7 @@ void SAMD21PDM::enable()
 
     // Initiate a DMA transfer.
     enabled = true;
-    invalid = SAMD21_START_UP_DELAY;
+    restartSettling();
     startDMA();
 }
 
@@ -316,22 +1209,28 @@ void SAMD21PDM::enable()
  */
 void SAMD21PDM::disable()
 {
-    // Schedule all DMA transfers to stop after the next DMA transaction completes.
+    // Schedule all DMA transfers to stop after the current DMA block transfer completes.
     enabled = false;
 }
 
 /**
- * Initiate a DMA transfer into the raw data buffer.
+ * Initiate continuous DMA transfers into the raw data buffer ring, starting with the first buffer.
  */
 void SAMD21PDM::startDMA()
 {
-    // TODO: Determine if we can move these three lines into the constructor.
-    DmacDescriptor &descriptor = dmac.getDescriptor(dmaChannel);
-    descriptor.DSTADDR.reg = ((uint32_t) pdmReceiveBuffer) + SAMD21_PDM_BUFFER_SIZE;
-    descriptor.BTCNT.bit.BTCNT = SAMD21_PDM_BUFFER_SIZE / 4;
+    if (dmaChannel == DEVICE_NO_RESOURCES)
+        return;
 
-    // Enable the DMA channel.
+    // Ensure any previous transfer has stopped, so we restart at the head of the descriptor chain.
     DMAC->CHID.bit.ID = dmaChannel;
+    DMAC->CHCTRLA.bit.ENABLE = 0;
+    while(DMAC->CHCTRLA.bit.ENABLE);
+
+    // Discard any data from a previous session.
+    rawWritten = 0;
+    rawRead = 0;
+
+    // Enable the DMA channel.
     DMAC->CHCTRLA.bit.ENABLE = 1;
 
     // Access the Data buffer once, to ensure we don't miss a DMA trigger...
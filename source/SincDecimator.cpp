@@ -0,0 +1,56 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "SincDecimator.h"
+
+// The windowed sinc filter taps, for a decimation of 64.
+constexpr uint16_t SincDecimator::filter[SINC_DECIMATOR_TAPS];
+
+#if CONFIG_ENABLED(SAMD21_PDM_LUT_DECIMATION)
+/**
+ * Computes the contribution of a single byte of PDM data to the filter output.
+ * Bit 0 is the chronologically first sample, and is weighted by taps[0].
+ *
+ * @param taps The filter taps aligned with the byte.
+ * @param value The byte of PDM data.
+ */
+static constexpr uint16_t pdmPartialSum(const uint16_t *taps, int value)
+{
+    return value == 0 ? 0 : ((value & 1) ? taps[0] : 0) + pdmPartialSum(taps + 1, value >> 1);
+}
+
+/**
+ * The filter contribution of every possible byte value, for each byte position in the filter window.
+ * Generated at compile time from the filter taps, and held in flash.
+ */
+#define PDM_LUT_1(p, v)     pdmPartialSum(&SincDecimator::filter[(p)*8], (v))
+#define PDM_LUT_4(p, v)     PDM_LUT_1(p, v), PDM_LUT_1(p, v+1), PDM_LUT_1(p, v+2), PDM_LUT_1(p, v+3)
+#define PDM_LUT_16(p, v)    PDM_LUT_4(p, v), PDM_LUT_4(p, v+4), PDM_LUT_4(p, v+8), PDM_LUT_4(p, v+12)
+#define PDM_LUT_64(p, v)    PDM_LUT_16(p, v), PDM_LUT_16(p, v+16), PDM_LUT_16(p, v+32), PDM_LUT_16(p, v+48)
+#define PDM_LUT(p)          { PDM_LUT_64(p, 0), PDM_LUT_64(p, 64), PDM_LUT_64(p, 128), PDM_LUT_64(p, 192) }
+
+const uint16_t SincDecimator::lookup[SINC_DECIMATOR_TAPS/8][256] = {
+    PDM_LUT(0), PDM_LUT(1), PDM_LUT(2), PDM_LUT(3), PDM_LUT(4), PDM_LUT(5), PDM_LUT(6), PDM_LUT(7)
+};
+#endif
@@ -0,0 +1,340 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "CodalCompat.h"
+#include "SpectrumAnalyser.h"
+#include "IntegerMath.h"
+
+#define SPECTRUM_ANALYSER_QUARTER           (SPECTRUM_ANALYSER_MAX_SIZE / 4)
+
+//
+// The first quarter of a sine wave in Q15, with SPECTRUM_ANALYSER_MAX_SIZE points per cycle.
+// The twiddle factors for every supported transform size are drawn from this table.
+//
+static const int16_t sineTable[SPECTRUM_ANALYSER_QUARTER + 1] = {
+    0, 402, 804, 1206, 1608, 2009, 2410, 2811, 3212, 3612, 4011, 4410, 4808, 5205, 5602, 5998,
+    6393, 6786, 7179, 7571, 7962, 8351, 8739, 9126, 9512, 9896, 10278, 10659, 11039, 11417, 11793, 12167,
+    12539, 12910, 13279, 13645, 14010, 14372, 14732, 15090, 15446, 15800, 16151, 16499, 16846, 17189, 17530, 17869,
+    18204, 18537, 18868, 19195, 19519, 19841, 20159, 20475, 20787, 21096, 21403, 21705, 22005, 22301, 22594, 22884,
+    23170, 23452, 23731, 24007, 24279, 24547, 24811, 25072, 25329, 25582, 25832, 26077, 26319, 26556, 26790, 27019,
+    27245, 27466, 27683, 27896, 28105, 28310, 28510, 28706, 28898, 29085, 29268, 29447, 29621, 29791, 29956, 30117,
+    30273, 30424, 30571, 30714, 30852, 30985, 31113, 31237, 31356, 31470, 31580, 31685, 31785, 31880, 31971, 32057,
+    32137, 32213, 32285, 32351, 32412, 32469, 32521, 32567, 32609, 32646, 32678, 32705, 32728, 32745, 32757, 32765,
+    32767};
+
+//
+// The first half of a SPECTRUM_ANALYSER_MAX_SIZE point Hann window in Q15. The window is symmetric, and
+// smaller frames sample it at a proportionally larger stride.
+//
+static const int16_t hannTable[SPECTRUM_ANALYSER_MAX_SIZE / 2 + 1] = {
+    0, 1, 5, 11, 20, 31, 44, 60, 79, 100, 123, 149, 177, 208, 241, 277,
+    315, 355, 398, 443, 491, 541, 593, 648, 705, 765, 827, 891, 958, 1027, 1098, 1171,
+    1247, 1325, 1406, 1488, 1573, 1660, 1749, 1841, 1935, 2030, 2128, 2229, 2331, 2435, 2542, 2650,
+    2761, 2874, 2989, 3105, 3224, 3345, 3468, 3592, 3719, 3847, 3978, 4110, 4244, 4380, 4518, 4657,
+    4799, 4942, 5086, 5233, 5381, 5531, 5682, 5835, 5990, 6146, 6304, 6463, 6624, 6786, 6950, 7115,
+    7281, 7449, 7618, 7789, 7961, 8134, 8308, 8484, 8660, 8838, 9017, 9197, 9379, 9561, 9744, 9929,
+    10114, 10300, 10487, 10675, 10864, 11054, 11244, 11436, 11628, 11820, 12014, 12208, 12403, 12598, 12794, 12990,
+    13187, 13385, 13583, 13781, 13980, 14179, 14378, 14578, 14778, 14978, 15178, 15379, 15580, 15780, 15981, 16182,
+    16383, 16585, 16786, 16987, 17187, 17388, 17589, 17789, 17989, 18189, 18389, 18588, 18787, 18986, 19184, 19382,
+    19580, 19777, 19973, 20169, 20364, 20559, 20753, 20947, 21139, 21331, 21523, 21713, 21903, 22092, 22280, 22467,
+    22653, 22838, 23023, 23206, 23388, 23570, 23750, 23929, 24107, 24283, 24459, 24633, 24806, 24978, 25149, 25318,
+    25486, 25652, 25817, 25981, 26143, 26304, 26463, 26621, 26777, 26932, 27085, 27236, 27386, 27534, 27681, 27825,
+    27968, 28110, 28249, 28387, 28523, 28657, 28789, 28920, 29048, 29175, 29299, 29422, 29543, 29662, 29778, 29893,
+    30006, 30117, 30225, 30332, 30436, 30538, 30639, 30737, 30832, 30926, 31018, 31107, 31194, 31279, 31361, 31442,
+    31520, 31596, 31669, 31740, 31809, 31876, 31940, 32002, 32062, 32119, 32174, 32226, 32276, 32324, 32369, 32412,
+    32452, 32490, 32526, 32559, 32590, 32618, 32644, 32667, 32688, 32707, 32723, 32736, 32747, 32756, 32762, 32766,
+    32767};
+
+/**
+ * Determines sin(2 * pi * i / SPECTRUM_ANALYSER_MAX_SIZE) in Q15.
+ */
+static inline int32_t sine(int i)
+{
+    i &= SPECTRUM_ANALYSER_MAX_SIZE - 1;
+
+    int r = i & (SPECTRUM_ANALYSER_QUARTER - 1);
+
+    switch (i / SPECTRUM_ANALYSER_QUARTER)
+    {
+        case 0:
+            return sineTable[r];
+        case 1:
+            return sineTable[SPECTRUM_ANALYSER_QUARTER - r];
+        case 2:
+            return -sineTable[r];
+        default:
+            return -sineTable[SPECTRUM_ANALYSER_QUARTER - r];
+    }
+}
+
+/**
+ * Determines cos(2 * pi * i / SPECTRUM_ANALYSER_MAX_SIZE) in Q15.
+ */
+static inline int32_t cosine(int i)
+{
+    return sine(i + SPECTRUM_ANALYSER_QUARTER);
+}
+
+/**
+ * Constructor for a spectrum analyser, which connects itself to the given source.
+ *
+ * @param source The component producing 16 bit mono PCM samples.
+ * @param size The number of samples in each frame. Rounded down to a power of two between
+ * SPECTRUM_ANALYSER_MIN_SIZE and SPECTRUM_ANALYSER_MAX_SIZE.
+ * @param hop The number of samples between the start of consecutive frames (1..size), or zero for
+ * frames overlapping by half.
+ */
+SpectrumAnalyser::SpectrumAnalyser(DataSource &source, int size, int hop) : upstream(source), output(*this)
+{
+    this->size = SPECTRUM_ANALYSER_MIN_SIZE;
+    while (this->size < SPECTRUM_ANALYSER_MAX_SIZE && this->size * 2 <= size)
+        this->size *= 2;
+
+    this->hop = (hop <= 0 || hop > this->size) ? this->size / 2 : hop;
+    this->filled = 0;
+
+    frame = ManagedBuffer(this->size * sizeof(int16_t));
+    work = ManagedBuffer(this->size * sizeof(int16_t));
+
+    // Allocate all of our spectrum buffers up front, so that no heap allocation takes place per frame.
+    // The pool retains a reference to each, so they are never freed.
+    for (int i = 0; i < SPECTRUM_ANALYSER_POOL_SIZE; i++)
+        pool[i] = ManagedBuffer(this->size / 2 * sizeof(uint16_t)).leakData();
+
+    poolIdleReference = pool[0]->refCount;
+    poolExhausted = 0;
+
+    upstream.connect(*this);
+}
+
+/**
+ * Callback provided when data is ready.
+ */
+int SpectrumAnalyser::pullRequest()
+{
+    ManagedBuffer b = upstream.pull();
+
+    const int16_t *in = (const int16_t *) &b[0];
+    const int16_t *end = in + b.length() / sizeof(int16_t);
+    int16_t *samples = (int16_t *) &frame[0];
+
+    while (in < end)
+    {
+        int count = min((int)(end - in), size - filled);
+
+        memcpy(samples + filled, in, count * sizeof(int16_t));
+        filled += count;
+        in += count;
+
+        if (filled == size)
+        {
+            ManagedBuffer next;
+
+            for (int i = 0; i < SPECTRUM_ANALYSER_POOL_SIZE; i++)
+            {
+                if (pool[i]->refCount == poolIdleReference)
+                {
+                    next = ManagedBuffer(pool[i]);
+                    break;
+                }
+            }
+
+            // If every buffer is still held downstream, drop this frame rather than overwrite one.
+            if (next.length() == 0)
+            {
+                poolExhausted++;
+            }
+            else
+            {
+                transform(samples, (int16_t *) &work[0], (uint16_t *) &next[0], size);
+                spectrum = next;
+                output.pullRequest();
+            }
+
+            // Retain the overlapping tail of this frame as the start of the next.
+            memmove(samples, samples + hop, (size - hop) * sizeof(int16_t));
+            filled = size - hop;
+        }
+    }
+
+    return DEVICE_OK;
+}
+
+/**
+ * Provide the most recent spectrum to our downstream component.
+ */
+ManagedBuffer SpectrumAnalyser::pull()
+{
+    return spectrum;
+}
+
+/**
+ * Register a downstream component to receive each spectrum as it is completed.
+ */
+void SpectrumAnalyser::connect(DataSink &sink)
+{
+    output.connect(sink);
+}
+
+/**
+ * Determines the number of samples in each frame. Half this number of bins is published per frame.
+ *
+ * @return the frame size, in samples.
+ */
+int SpectrumAnalyser::getSize()
+{
+    return size;
+}
+
+/**
+ * Determines the magnitude of the given frequency bin in the most recent spectrum.
+ *
+ * @param bin The bin of interest, between 0 and getSize() / 2 - 1.
+ *
+ * @return the magnitude of the bin, or DEVICE_INVALID_PARAMETER if the bin is out of range.
+ */
+int SpectrumAnalyser::getMagnitude(int bin)
+{
+    if (bin < 0 || bin >= size / 2)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (spectrum.length() == 0)
+        return 0;
+
+    return ((uint16_t *) &spectrum[0])[bin];
+}
+
+/**
+ * Determines the frequency bin holding the most energy in the most recent spectrum, ignoring the DC bin.
+ *
+ * @return the index of the loudest bin, or zero if no spectrum is yet available.
+ */
+int SpectrumAnalyser::getPeakBin()
+{
+    int peak = 0;
+
+    if (spectrum.length() == 0)
+        return 0;
+
+    uint16_t *magnitude = (uint16_t *) &spectrum[0];
+
+    for (int i = 1; i < size / 2; i++)
+        if (magnitude[i] > magnitude[peak] || peak == 0)
+            peak = i;
+
+    return peak;
+}
+
+/**
+ * Determines how often a spectrum was dropped because every buffer in the pool was still held downstream.
+ *
+ * @return the number of spectra dropped since this component was created.
+ */
+uint32_t SpectrumAnalyser::getPoolExhaustedCount()
+{
+    return poolExhausted;
+}
+
+/**
+ * Computes the magnitude spectrum of a frame of real valued samples.
+ * A size point real transform is computed using a size / 2 point complex transform, scaling by 1/2 each stage
+ * to avoid overflow. A full scale sine wave therefore produces a magnitude of approximately 16384 in its bin.
+ *
+ * @param samples The size samples to analyse.
+ * @param work Scratch space for size values.
+ * @param magnitude Set to the size / 2 bin magnitudes.
+ * @param size The number of samples, a power of two between SPECTRUM_ANALYSER_MIN_SIZE and SPECTRUM_ANALYSER_MAX_SIZE.
+ */
+void SpectrumAnalyser::transform(const int16_t *samples, int16_t *work, uint16_t *magnitude, int size)
+{
+    int points = size / 2;
+    int stride = SPECTRUM_ANALYSER_MAX_SIZE / size;
+    int bits = 0;
+
+    while ((1 << bits) < points)
+        bits++;
+
+    // Window the frame, and pack even and odd samples into the real and imaginary parts of a half length complex
+    // sequence, in bit reversed order.
+    for (int i = 0; i < points; i++)
+    {
+        int r = 0;
+        for (int b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+
+        int n = 2 * i * stride;
+        int32_t w0 = hannTable[n <= SPECTRUM_ANALYSER_MAX_SIZE / 2 ? n : SPECTRUM_ANALYSER_MAX_SIZE - n];
+        n += stride;
+        int32_t w1 = hannTable[n <= SPECTRUM_ANALYSER_MAX_SIZE / 2 ? n : SPECTRUM_ANALYSER_MAX_SIZE - n];
+
+        work[2 * r] = (samples[2 * i] * w0) >> 15;
+        work[2 * r + 1] = (samples[2 * i + 1] * w1) >> 15;
+    }
+
+    // Radix-2 decimation in time butterflies, halving at each stage.
+    for (int length = 2; length <= points; length <<= 1)
+    {
+        int half = length / 2;
+        int step = SPECTRUM_ANALYSER_MAX_SIZE / length;
+
+        for (int k = 0; k < half; k++)
+        {
+            int32_t wr = cosine(k * step);
+            int32_t wi = -sine(k * step);
+
+            for (int i = k; i < points; i += length)
+            {
+                int16_t *a = &work[2 * i];
+                int16_t *b = &work[2 * (i + half)];
+
+                int32_t tr = (wr * b[0] - wi * b[1]) >> 15;
+                int32_t ti = (wr * b[1] + wi * b[0]) >> 15;
+
+                b[0] = (a[0] - tr) >> 1;
+                b[1] = (a[1] - ti) >> 1;
+                a[0] = (a[0] + tr) >> 1;
+                a[1] = (a[1] + ti) >> 1;
+            }
+        }
+    }
+
+    // Separate the spectra of the even and odd samples, and combine them into the spectrum of the real frame.
+    for (int k = 0; k < points; k++)
+    {
+        int m = (points - k) & (points - 1);
+
+        int32_t er = (work[2 * k] + work[2 * m]) >> 1;
+        int32_t ei = (work[2 * k + 1] - work[2 * m + 1]) >> 1;
+        int32_t or_ = (work[2 * k + 1] + work[2 * m + 1]) >> 1;
+        int32_t oi = (work[2 * m] - work[2 * k]) >> 1;
+
+        int32_t c = cosine(k * stride);
+        int32_t s = sine(k * stride);
+
+        int32_t re = er + ((c * or_ + s * oi) >> 15);
+        int32_t im = ei + ((c * oi - s * or_) >> 15);
+
+        magnitude[k] = isqrt((uint32_t)(re * re) + (uint32_t)(im * im));
+    }
+}
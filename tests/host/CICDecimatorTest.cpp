@@ -0,0 +1,258 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "HostTest.h"
+#include "HostSignal.h"
+#include "CICDecimator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+//
+// The compensation FIR side taps, in Q8, that the reference model expects for each stage count.
+//
+static const int referenceCompensation[CIC_DECIMATOR_MAX_STAGES] = {14, 30, 47, 67};
+
+/**
+ * A bit at a time model of the CIC and compensation filter, with integrators wide enough not to wrap.
+ */
+class ReferenceCIC
+{
+    uint64_t    integrator[CIC_DECIMATOR_MAX_STAGES];
+    uint64_t    comb[CIC_DECIMATOR_MAX_STAGES];
+    int64_t     history[2];
+    int         decimation;
+    int         stages;
+
+public:
+
+    ReferenceCIC(int decimation, int stages) : decimation(decimation), stages(stages)
+    {
+        for (int i = 0; i < CIC_DECIMATOR_MAX_STAGES; i++)
+            integrator[i] = comb[i] = 0;
+
+        history[0] = history[1] = 0;
+    }
+
+    void integrate(uint32_t bits)
+    {
+        for (int b = 0; b < 16; b++)
+        {
+            integrator[0] += (bits >> b) & 1;
+
+            for (int s = 1; s < stages; s++)
+                integrator[s] += integrator[s - 1];
+        }
+    }
+
+    int decimate()
+    {
+        uint64_t v = integrator[stages - 1];
+
+        for (int s = 0; s < stages; s++)
+        {
+            uint64_t t = v - comb[s];
+            comb[s] = v;
+            v = t;
+        }
+
+        int gain = 0;
+        while ((1 << gain) < decimation)
+            gain++;
+        gain *= stages;
+
+        int64_t sample = (gain >= 16 ? (int64_t) (v >> (gain - 16)) : (int64_t) (v << (16 - gain))) - 32768;
+        int64_t a = referenceCompensation[stages - 1];
+        int64_t y = ((256 + 2 * a) * history[0] - a * (sample + history[1])) >> 8;
+
+        history[1] = history[0];
+        history[0] = sample;
+
+        return y > 32767 ? 32767 : y < -32768 ? -32768 : (int) y;
+    }
+
+    /**
+     * The response of the CIC and compensation filter to a tone, relative to DC.
+     *
+     * @param frequency The frequency of the tone, in cycles per output sample.
+     */
+    double response(double frequency)
+    {
+        double f = frequency / decimation;
+        double cic = f == 0 ? 1.0 : fabs(sin(M_PI * f * decimation) / (decimation * sin(M_PI * f)));
+        double a = referenceCompensation[stages - 1] / 256.0;
+
+        return pow(cic, stages) * fabs(1 + 2 * a - 2 * a * cos(2 * M_PI * frequency));
+    }
+};
+
+/**
+ * Checks the CIC decimator against the reference model, bit for bit, for every supported configuration,
+ * then measures its frequency response and the cost of each output sample.
+ */
+HOST_TEST(cic)
+{
+    int failures = 0;
+
+    for (int stages = 1; stages <= CIC_DECIMATOR_MAX_STAGES; stages++)
+    {
+        for (int decimation = 16; decimation <= 256; decimation *= 2)
+        {
+            CICDecimator cic;
+
+            if (cic.configure(decimation, stages) != DEVICE_OK)
+            {
+                failures += hostCheck(decimation > 128 && stages == CIC_DECIMATOR_MAX_STAGES, "decimation %d with %d stages was rejected", decimation, stages);
+                continue;
+            }
+
+            ReferenceCIC reference(decimation, stages);
+            int mismatches = 0;
+
+            srand(stages * decimation);
+
+            for (int o = 0; o < 1000; o++)
+            {
+                for (int w = 0; w < decimation / 16; w++)
+                {
+                    uint32_t bits = rand() & 0xFFFF;
+
+                    // Bias some blocks towards full scale in each direction, to exercise the clipping.
+                    if (o % 100 > 90)
+                        bits = (o & 1) ? bits | 0xEFFF : bits & 0x1000;
+
+                    cic.integrate(bits);
+                    reference.integrate(bits);
+                }
+
+                mismatches += cic.decimate() != reference.decimate();
+            }
+
+            failures += hostCheck(mismatches == 0, "decimation %d with %d stages differs from the reference in %d samples", decimation, stages, mismatches);
+        }
+    }
+
+    // Measure the response to tones across the passband, and to tones that alias into it, at a decimation of 64.
+    // The amplitude of each tone is measured in the bitstream itself, so the response is that of the filter alone.
+    const int decimation = 64;
+    const int outputs = 16384;
+    const double frequencies[] = {0.01, 0.05, 0.1, 0.2, 0.3, 0.4, 0.45, 0.9, 1.1, 1.9, 2.1};
+
+    printf("    frequency response at decimation %d (dB, measured / model):\n", decimation);
+    printf("      f/fs  ");
+    for (int stages = 1; stages <= CIC_DECIMATOR_MAX_STAGES; stages++)
+        printf("   %d stage%s     ", stages, stages > 1 ? "s" : " ");
+    printf("\n");
+
+    for (double frequency : frequencies)
+    {
+        std::vector<uint32_t> pdm(outputs * decimation / 16);
+        std::vector<double> bits(outputs * decimation);
+
+        // PDMModulator holds each PCM sample for 16 PDM samples, and the images of that hold would alias into the
+        // passband too. So the tone is modulated here a bit at a time, by a second order loop of the same form.
+        double integrator[2] = {0, 0};
+
+        for (size_t i = 0; i < bits.size(); i++)
+        {
+            double feedback = integrator[1] >= 0 ? 32767 : -32768;
+            double sample = 16384 * sin(2 * M_PI * frequency * i / decimation);
+
+            if (feedback > 0)
+                pdm[i / 16] |= 1 << (i % 16);
+
+            bits[i] = feedback;
+            integrator[0] += sample - feedback;
+            integrator[1] += integrator[0] - feedback;
+        }
+
+        double input = hostFitSine(bits.data(), bits.size(), frequency / decimation).amplitude;
+        double alias = fmod(frequency, 1.0) > 0.5 ? 1.0 - fmod(frequency, 1.0) : fmod(frequency, 1.0);
+
+        printf("      %4.2f  ", frequency);
+
+        for (int stages = 1; stages <= CIC_DECIMATOR_MAX_STAGES; stages++)
+        {
+            CICDecimator cic(decimation, stages);
+            ReferenceCIC model(decimation, stages);
+            std::vector<double> pcm(outputs);
+
+            for (int o = 0; o < outputs; o++)
+            {
+                for (int w = 0; w < decimation / 16; w++)
+                    cic.integrate(pdm[o * decimation / 16 + w]);
+
+                pcm[o] = cic.decimate();
+            }
+
+            // Skip the first few samples, while the filter settles.
+            double measured = hostDecibels(hostFitSine(&pcm[16], outputs - 16, alias).amplitude / input);
+            double expected = hostDecibels(model.response(frequency));
+
+            printf("%6.2f / %6.2f  ", measured, expected);
+
+            if (frequency < 0.5)
+                failures += hostCheck(fabs(measured - expected) < 0.1, "response at %.2f fs with %d stages is %.2f dB, expected %.2f dB", frequency, stages, measured, expected);
+            else
+                failures += hostCheck(measured < expected + 3, "rejection at %.2f fs with %d stages is %.2f dB, expected %.2f dB", frequency, stages, measured, expected);
+        }
+
+        printf("\n");
+    }
+
+    // Measure the cost of each output sample.
+    std::vector<uint32_t> pdm(outputs * decimation / 16);
+    srand(1);
+    for (auto &w : pdm)
+        w = rand() & 0xFFFF;
+
+    for (int stages = 1; stages <= CIC_DECIMATOR_MAX_STAGES; stages++)
+    {
+        CICDecimator cic(decimation, stages);
+        volatile int sink = 0;
+        uint64_t best = ~0ULL;
+
+        for (int run = 0; run < 5; run++)
+        {
+            uint64_t start = hostCycles();
+
+            for (int o = 0; o < outputs; o++)
+            {
+                for (int w = 0; w < decimation / 16; w++)
+                    cic.integrate(pdm[o * decimation / 16 + w]);
+
+                sink = sink + cic.decimate();
+            }
+
+            uint64_t elapsed = hostCycles() - start;
+            if (elapsed < best)
+                best = elapsed;
+        }
+
+        printf("    %d stage%s at decimation %d: %.1f %s per output sample\n", stages, stages > 1 ? "s" : "", decimation, (double) best / outputs, hostCycleUnit());
+    }
+
+    return failures;
+}
@@ -0,0 +1,172 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "HostTest.h"
+#include "SAMD21ClockPlanner.h"
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+/**
+ * Checks that a plan is within the limits of the hardware, and that the sample rate it actually produces, worked out
+ * independently from the clock configuration and dither pattern, has the error it reports.
+ *
+ * @param name A description of the plan, for reporting failures.
+ * @param rate The sample rate requested.
+ * @param reference The frequency of the DPLL's reference clock.
+ * @param plan The plan.
+ */
+static int checkPlan(const char *name, uint32_t rate, uint32_t reference, SAMD21ClockPlan &plan)
+{
+    int failures = 0;
+    double clock = plan.clock;
+
+    if (plan.dpll)
+    {
+        double output = reference * (plan.dpllRatio + 1 + plan.dpllFraction / 16.0);
+        clock = output / plan.divider;
+
+        failures += hostCheck(output >= SAMD21_CLOCK_PLANNER_DPLL_MIN && output <= SAMD21_CLOCK_PLANNER_DPLL_MAX, "%s: DPLL output of %.0fHz", name, output);
+        failures += hostCheck(plan.dpllRatio <= SAMD21_CLOCK_PLANNER_DPLL_LDR_MAX && plan.dpllFraction < 16, "%s: DPLL ratio %u, fraction %u", name, plan.dpllRatio, plan.dpllFraction);
+        failures += hostCheck(plan.divider >= 1 && plan.divider <= SAMD21_CLOCK_PLANNER_GCLK_DIV_MAX, "%s: divider of %u", name, plan.divider);
+        failures += hostCheck(fabs(clock - plan.clock) < 1, "%s: clock of %.1fHz reported as %uHz", name, clock, plan.clock);
+    }
+
+    failures += hostCheck(clock <= SAMD21_CLOCK_PLANNER_TC_MAX, "%s: timer clock of %.0fHz", name, clock);
+    failures += hostCheck(plan.period >= 2 && plan.period < SAMD21_CLOCK_PLANNER_PERIOD_MAX, "%s: period of %u", name, plan.period);
+    failures += hostCheck(plan.ditherLength >= 1 && plan.ditherLength <= SAMD21_CLOCK_PLANNER_DITHER_MAX && plan.ditherCount < plan.ditherLength, "%s: dither of %u in %u", name, plan.ditherCount, plan.ditherLength);
+
+    if (failures)
+        return failures;
+
+    // Each entry of the pattern is one less than the period it gives, and exactly ditherCount are one tick longer.
+    std::vector<uint16_t> pattern(plan.ditherLength);
+    SAMD21ClockPlanner::fillDitherPattern(plan, pattern.data());
+
+    double ticks = 0;
+    uint32_t longer = 0;
+    int invalid = 0;
+
+    for (uint32_t i = 0; i < plan.ditherLength; i++)
+    {
+        uint32_t period = pattern[i] + 1;
+
+        ticks += period;
+        longer += period == plan.period + 1;
+        invalid += period != plan.period && period != plan.period + 1;
+    }
+
+    double achieved = clock * plan.ditherLength / ticks;
+    double error = (achieved / rate - 1) * 1e9;
+
+    failures += hostCheck(invalid == 0 && longer == plan.ditherCount, "%s: %u of %u periods longer, %d invalid", name, longer, plan.ditherLength, invalid);
+    failures += hostCheck(fabs(error - plan.error) <= 1, "%s: achieves %.6fHz (%.1fppb), reported as %dppb", name, achieved, error, plan.error);
+
+    return failures;
+}
+
+/**
+ * Plans a range of sample rates from the clocks SAMD21DAC uses, with and without the DPLL, and checks each plan
+ * against the hardware's limits and its reported error. Then checks some known plans.
+ */
+HOST_TEST(planner)
+{
+    const uint32_t rates[] = {1000, 731, 8000, 11025, 12345, 16000, 22050, 32000, 44100, 48000, 96000, 100000};
+    const uint32_t reference = 32768;
+    int failures = 0;
+
+    for (int dpll = 0; dpll < 2; dpll++)
+    {
+        for (unsigned i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+        {
+            SAMD21ClockPlanner planner;
+            SAMD21ClockPlan plan;
+            char name[32];
+
+            planner.addSource(0, 48000000);
+            planner.addSource(1, 8000000);
+
+            if (dpll)
+                planner.setDpll(reference, 7);
+
+            snprintf(name, sizeof(name), "%uHz%s", rates[i], dpll ? " with DPLL" : "");
+
+            if (hostCheck(planner.plan(rates[i], plan) == DEVICE_OK, "%s: no plan", name))
+            {
+                failures++;
+                continue;
+            }
+
+            printf("    %s: generator %d, clock %uHz, period %u, dither %u in %u, error %dppb\n", name, plan.generator, plan.clock, plan.period, plan.ditherCount, plan.ditherLength, plan.error);
+
+            failures += checkPlan(name, rates[i], reference, plan);
+            failures += hostCheck(plan.error >= -2 && plan.error <= 2, "%s: error of %dppb", name, plan.error);
+        }
+    }
+
+    // 44.1kHz is an exact fraction of 48MHz, and an exact multiple of 32768Hz within the DPLL's range.
+    {
+        SAMD21ClockPlanner planner;
+        SAMD21ClockPlan plan;
+
+        planner.addSource(0, 48000000);
+        planner.plan(44100, plan);
+        failures += hostCheck(!plan.dpll && plan.error == 0 && plan.ditherLength > 1, "44100Hz: error %dppb, dither length %u", plan.error, plan.ditherLength);
+
+        planner.setDpll(reference, 7);
+        planner.plan(44100, plan);
+        failures += hostCheck(plan.dpll && plan.error == 0 && plan.ditherLength == 1, "44100Hz with DPLL: error %dppb, dither length %u", plan.error, plan.ditherLength);
+    }
+
+    // Without dithering, the nearest whole period is chosen.
+    {
+        SAMD21ClockPlanner planner;
+        SAMD21ClockPlan plan;
+
+        planner.addSource(0, 48000000);
+        planner.setDitherLimit(1);
+
+        failures += hostCheck(planner.plan(44100, plan) == DEVICE_OK, "44100Hz without dither: no plan");
+        failures += checkPlan("44100Hz without dither", 44100, reference, plan);
+        failures += hostCheck(plan.ditherLength == 1 && plan.period == 1088, "44100Hz without dither: period %u, dither length %u", plan.period, plan.ditherLength);
+    }
+
+    // Invalid configurations are refused.
+    {
+        SAMD21ClockPlanner planner;
+        SAMD21ClockPlan plan;
+
+        failures += hostCheck(planner.plan(44100, plan) == DEVICE_INVALID_PARAMETER, "a planner with no sources made a plan");
+
+        planner.addSource(0, 48000000);
+
+        failures += hostCheck(planner.plan(0, plan) == DEVICE_INVALID_PARAMETER, "a rate of zero was planned");
+        failures += hostCheck(planner.setDpll(1000, 7) == DEVICE_INVALID_PARAMETER, "a DPLL reference of 1kHz was accepted");
+        failures += hostCheck(planner.setDitherLimit(0) == DEVICE_INVALID_PARAMETER, "a dither limit of zero was accepted");
+        failures += hostCheck(planner.setDitherLimit(SAMD21_CLOCK_PLANNER_DITHER_MAX + 1) == DEVICE_INVALID_PARAMETER, "an overlong dither limit was accepted");
+    }
+
+    return failures;
+}
@@ -0,0 +1,113 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "HostSignal.h"
+#include <math.h>
+
+/**
+ * Fits a sine wave of known frequency (and any phase and DC offset) to a signal, by least squares.
+ *
+ * @param y The signal.
+ * @param length The number of samples in the signal.
+ * @param frequency The frequency of the sine wave, in cycles per sample.
+ */
+HostSineFit hostFitSine(const double *y, int length, double frequency)
+{
+    double a[3][4] = {{0}};
+    double x[3];
+
+    // Accumulate the normal equations for y = x0 sin(wt) + x1 cos(wt) + x2.
+    for (int i = 0; i < length; i++)
+    {
+        double basis[3] = {sin(2 * M_PI * frequency * i), cos(2 * M_PI * frequency * i), 1.0};
+
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 3; c++)
+                a[r][c] += basis[r] * basis[c];
+
+            a[r][3] += basis[r] * y[i];
+        }
+    }
+
+    // Solve by Gaussian elimination. The system is symmetric positive definite, so needs no pivoting.
+    for (int r = 0; r < 3; r++)
+        for (int s = r + 1; s < 3; s++)
+        {
+            double k = a[s][r] / a[r][r];
+            for (int c = r; c < 4; c++)
+                a[s][c] -= k * a[r][c];
+        }
+
+    for (int r = 2; r >= 0; r--)
+    {
+        x[r] = a[r][3];
+        for (int c = r + 1; c < 3; c++)
+            x[r] -= a[r][c] * x[c];
+        x[r] /= a[r][r];
+    }
+
+    double signal = 0;
+    double residual = 0;
+
+    for (int i = 0; i < length; i++)
+    {
+        double s = x[0] * sin(2 * M_PI * frequency * i) + x[1] * cos(2 * M_PI * frequency * i);
+        double e = y[i] - s - x[2];
+
+        signal += s * s;
+        residual += e * e;
+    }
+
+    HostSineFit fit;
+    fit.amplitude = sqrt(x[0] * x[0] + x[1] * x[1]);
+    fit.sine = x[0];
+    fit.cosine = x[1];
+    fit.offset = x[2];
+    fit.sinad = residual > 0 ? 10 * log10(signal / residual) : INFINITY;
+
+    return fit;
+}
+
+/**
+ * Removes a fitted sine wave and DC offset from a signal, leaving everything else.
+ *
+ * @param y The signal, which is updated in place.
+ * @param length The number of samples in the signal.
+ * @param frequency The frequency of the sine wave, in cycles per sample.
+ * @param fit The sine wave fitted to the signal by hostFitSine().
+ */
+void hostRemoveSine(double *y, int length, double frequency, const HostSineFit &fit)
+{
+    for (int i = 0; i < length; i++)
+        y[i] -= fit.sine * sin(2 * M_PI * frequency * i) + fit.cosine * cos(2 * M_PI * frequency * i) + fit.offset;
+}
+
+/**
+ * Converts an amplitude ratio to decibels.
+ */
+double hostDecibels(double ratio)
+{
+    return 20 * log10(ratio);
+}
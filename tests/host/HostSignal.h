@@ -0,0 +1,64 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef HOST_SIGNAL_H
+#define HOST_SIGNAL_H
+
+/**
+ * The result of fitting a sine wave to a signal.
+ */
+struct HostSineFit
+{
+    double      amplitude;                              // The amplitude of the fitted sine wave.
+    double      sine;                                   // The sine component of the fitted wave.
+    double      cosine;                                 // The cosine component of the fitted wave.
+    double      offset;                                 // The DC offset of the signal.
+    double      sinad;                                  // The power of the sine wave relative to everything else, in dB.
+};
+
+/**
+ * Fits a sine wave of known frequency (and any phase and DC offset) to a signal, by least squares.
+ *
+ * @param y The signal.
+ * @param length The number of samples in the signal.
+ * @param frequency The frequency of the sine wave, in cycles per sample.
+ */
+HostSineFit hostFitSine(const double *y, int length, double frequency);
+
+/**
+ * Removes a fitted sine wave and DC offset from a signal, leaving everything else.
+ *
+ * @param y The signal, which is updated in place.
+ * @param length The number of samples in the signal.
+ * @param frequency The frequency of the sine wave, in cycles per sample.
+ * @param fit The sine wave fitted to the signal by hostFitSine().
+ */
+void hostRemoveSine(double *y, int length, double frequency, const HostSineFit &fit);
+
+/**
+ * Converts an amplitude ratio to decibels.
+ */
+double hostDecibels(double ratio);
+
+#endif
@@ -0,0 +1,113 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "HostTest.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HOST_TEST_TSC 1
+#endif
+
+static HostTest *tests = NULL;
+
+HostTest::HostTest(const char *name, HostTestFunction function)
+{
+    this->name = name;
+    this->function = function;
+
+    // Keep the tests in order of registration.
+    HostTest **p = &tests;
+    while (*p)
+        p = &(*p)->next;
+
+    this->next = NULL;
+    *p = this;
+}
+
+int hostCheck(bool condition, const char *format, ...)
+{
+    if (condition)
+        return 0;
+
+    va_list args;
+    va_start(args, format);
+    printf("    FAIL: ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+
+    return 1;
+}
+
+uint64_t hostCycles()
+{
+#ifdef HOST_TEST_TSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+const char *hostCycleUnit()
+{
+#ifdef HOST_TEST_TSC
+    return "TSC cycles";
+#else
+    return "ns";
+#endif
+}
+
+/**
+ * Runs the named test with the remaining arguments, or every test if no name is given.
+ */
+int main(int argc, char **argv)
+{
+    int failures = 0;
+    int run = 0;
+
+    for (HostTest *t = tests; t; t = t->next)
+    {
+        if (argc > 1 && strcmp(argv[1], t->name) != 0)
+            continue;
+
+        printf("%s\n", t->name);
+        int f = t->function(argc > 1 ? argc - 2 : 0, argv + 2);
+        printf("%s: %s\n", t->name, f ? "FAILED" : "passed");
+
+        failures += f;
+        run++;
+    }
+
+    if (run == 0)
+    {
+        printf("no test named %s\n", argv[1]);
+        return 1;
+    }
+
+    return failures ? 1 : 0;
+}
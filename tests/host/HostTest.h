@@ -0,0 +1,70 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdint.h>
+
+/**
+ * A test case, run by name from the host_tests executable. Returns the number of failed checks.
+ */
+typedef int (*HostTestFunction)(int argc, char **argv);
+
+struct HostTest
+{
+    const char          *name;                          // The name used to select the test from the command line.
+    HostTestFunction    function;                       // The test itself.
+    HostTest            *next;                          // The next registered test.
+
+    HostTest(const char *name, HostTestFunction function);
+};
+
+/**
+ * Defines and registers a test case. Any arguments following the test name on the command line are passed to it.
+ */
+#define HOST_TEST(name) \
+    static int name##Test(int argc, char **argv); \
+    static HostTest name##Registration(#name, name##Test); \
+    static int name##Test(int argc, char **argv)
+
+/**
+ * Reports the outcome of a check, printing the message if it failed.
+ *
+ * @return 0 if the condition holds, or 1 if it does not, for accumulation into a failure count.
+ */
+int hostCheck(bool condition, const char *format, ...);
+
+/**
+ * Reads a free running cycle counter, for benchmarks. The time stamp counter is used where available,
+ * otherwise a nanosecond clock.
+ */
+uint64_t hostCycles();
+
+/**
+ * The name of the unit counted by hostCycles(), for reports.
+ */
+const char *hostCycleUnit();
+
+#endif
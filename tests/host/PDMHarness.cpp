@@ -0,0 +1,509 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+//
+// A host harness for the PDM decimation filters used by SAMD21PDM.
+//
+// A WAV file or sine wave is converted into a PDM bitstream at clockRate (the output sample rate times the decimation
+// ratio) by PDMModulator, and decoded by the selected filter. The quality of the output is reported against the input,
+// along with the throughput of the filter in output samples per second, so changes to the decimators can be checked
+// for both quality and speed.
+//
+
+#include "HostSignal.h"
+#include "SincDecimator.h"
+#include "CICDecimator.h"
+#include "PDMModulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// The number of harmonics of a sine wave included in the THD.
+#define PDM_HARNESS_HARMONICS           9
+
+// The number of output samples discarded while the filters settle, before any measurement.
+#define PDM_HARNESS_SETTLE              64
+
+struct HarnessOptions
+{
+    const char  *wav = NULL;                            // A WAV file to use as input, or NULL for a sine wave.
+    double      sine = 1000;                            // The frequency of the sine wave, in Hz.
+    double      amplitude = -6;                         // The amplitude of the sine wave, in dBFS.
+    double      seconds = 1;                            // The duration of the sine wave, in seconds.
+    int         rate = 0;                               // The output sample rate, or zero for the default.
+    int         decimation = SINC_DECIMATOR_TAPS;       // The number of PDM samples per output sample.
+    int         stages = 0;                             // The number of CIC stages, or zero for the sinc filter.
+    bool        sweep = false;                          // true to measure the frequency response.
+    double      expect = 0;                             // The SINAD or SNR below which to report failure, in dB, or zero.
+    const char  *pdm = NULL;                            // A file to write the PDM bitstream to, or NULL.
+    const char  *out = NULL;                            // A WAV file to write the decoded output to, or NULL.
+};
+
+/**
+ * Reads the first channel of a 16 bit PCM WAV file.
+ *
+ * @return true on success, false if the file could not be read or is not 16 bit PCM.
+ */
+static bool readWav(const char *filename, std::vector<int16_t> &pcm, int &rate)
+{
+    FILE *f = fopen(filename, "rb");
+    uint8_t header[12];
+    int channels = 0;
+    int bits = 0;
+
+    if (!f)
+        return false;
+
+    if (fread(header, 1, 12, f) != 12 || memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4))
+    {
+        fclose(f);
+        return false;
+    }
+
+    uint8_t chunk[8];
+    while (fread(chunk, 1, 8, f) == 8)
+    {
+        uint32_t length = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t) chunk[7] << 24;
+        std::vector<uint8_t> data(length + (length & 1));
+
+        if (fread(data.data(), 1, data.size(), f) < length)
+            break;
+
+        if (!memcmp(chunk, "fmt ", 4) && length >= 16)
+        {
+            int format = data[0] | data[1] << 8;
+            channels = data[2] | data[3] << 8;
+            rate = data[4] | data[5] << 8 | data[6] << 16 | data[7] << 24;
+            bits = data[14] | data[15] << 8;
+
+            if (format != 1)
+                bits = 0;
+        }
+
+        if (!memcmp(chunk, "data", 4) && channels > 0 && bits == 16)
+        {
+            for (uint32_t i = 0; i + 2 * channels <= length; i += 2 * channels)
+                pcm.push_back((int16_t) (data[i] | data[i + 1] << 8));
+
+            fclose(f);
+            return true;
+        }
+    }
+
+    fclose(f);
+    return false;
+}
+
+/**
+ * Writes a mono 16 bit PCM WAV file.
+ */
+static bool writeWav(const char *filename, const std::vector<int16_t> &pcm, int rate)
+{
+    FILE *f = fopen(filename, "wb");
+
+    if (!f)
+        return false;
+
+    uint32_t bytes = pcm.size() * 2;
+    uint32_t fields[] = {36 + bytes, 16, 1 | 1 << 16, (uint32_t) rate, (uint32_t) rate * 2, 2 | 16 << 16, bytes};
+
+    fwrite("RIFF", 1, 4, f);
+    fwrite(&fields[0], 4, 1, f);
+    fwrite("WAVEfmt ", 1, 8, f);
+    fwrite(&fields[1], 4, 5, f);
+    fwrite("data", 1, 4, f);
+    fwrite(&fields[6], 4, 1, f);
+    fwrite(pcm.data(), 2, pcm.size(), f);
+
+    return fclose(f) == 0;
+}
+
+/**
+ * Decodes a PDM bitstream with the filter selected by the given options, as SAMD21PDM does.
+ */
+static std::vector<int16_t> decode(const std::vector<uint32_t> &pdm, const HarnessOptions &options)
+{
+    int words = options.decimation / 16;
+    int samples = pdm.size() / words;
+    std::vector<int16_t> pcm(samples);
+    const uint32_t *b = pdm.data();
+
+    if (options.stages)
+    {
+        CICDecimator cic(options.decimation, options.stages);
+
+        for (int i = 0; i < samples; i++)
+        {
+            for (int w = 0; w < words; w++)
+                cic.integrate(*b++ & 0xFFFF);
+
+            pcm[i] = cic.decimate();
+        }
+    }
+    else
+    {
+        for (int i = 0; i < samples; i++)
+        {
+            int32_t left, right;
+
+            SincDecimator::decimate(b, left, right, false);
+            b += words;
+
+            pcm[i] = left > 32767 ? 32767 : left < -32768 ? -32768 : left;
+        }
+    }
+
+    return pcm;
+}
+
+/**
+ * Reports the SNR, THD and SINAD of a decoded sine wave.
+ *
+ * @return the SINAD, in dB.
+ */
+static double analyseSine(const std::vector<double> &y, double frequency)
+{
+    int n = y.size();
+    HostSineFit fundamental = hostFitSine(y.data(), n, frequency);
+
+    // Everything but the fundamental is either distortion or noise. The harmonics are measured with the fundamental
+    // removed, so that none of it leaks into their fits.
+    std::vector<double> residual(y);
+    hostRemoveSine(residual.data(), n, frequency, fundamental);
+
+    double signal = fundamental.amplitude * fundamental.amplitude / 2;
+    double noise = 0;
+    double harmonics = 0;
+
+    for (double r : residual)
+        noise += r * r / n;
+
+    for (int h = 2; h <= PDM_HARNESS_HARMONICS + 1; h++)
+    {
+        // Harmonics above the Nyquist frequency are aliased back into the band.
+        double f = fmod(h * frequency, 1.0);
+        if (f > 0.5)
+            f = 1.0 - f;
+
+        if (f < 1.0 / n || fabs(f - frequency) < 1.0 / n)
+            continue;
+
+        double a = hostFitSine(residual.data(), n, f).amplitude;
+        harmonics += a * a / 2;
+    }
+
+    noise -= harmonics;
+
+    printf("fundamental: %.1f dBFS\n", hostDecibels(fundamental.amplitude / 32768));
+    printf("SNR:         %.1f dB\n", 10 * log10(signal / noise));
+    printf("THD:         %.1f dB (%.4f%%, %d harmonics)\n", 10 * log10(harmonics / signal), 100 * sqrt(harmonics / signal), PDM_HARNESS_HARMONICS);
+    printf("SINAD:       %.1f dB\n", fundamental.sinad);
+
+    return fundamental.sinad;
+}
+
+/**
+ * Reports the SNR of a decoded signal against its input, after matching their gain and delay.
+ *
+ * @return the SNR, in dB.
+ */
+static double analyseSignal(const std::vector<double> &y, const std::vector<int16_t> &input)
+{
+    const int taps = 4;
+    double best = -INFINITY;
+    int bestDelay = 0;
+
+    // The filters delay the signal by a fraction of a sample as well as a whole number of samples. So for each
+    // whole delay, the input is matched to the output by a short FIR, fitted by least squares.
+    for (int delay = 0; delay <= 8; delay++)
+    {
+        double a[taps][taps + 1] = {{0}};
+        double h[taps];
+
+        for (size_t i = PDM_HARNESS_SETTLE; i < y.size(); i++)
+        {
+            for (int r = 0; r < taps; r++)
+            {
+                for (int c = 0; c < taps; c++)
+                    a[r][c] += (double) input[i - delay - r] * input[i - delay - c];
+
+                a[r][taps] += input[i - delay - r] * y[i];
+            }
+        }
+
+        for (int r = 0; r < taps; r++)
+            for (int s = r + 1; s < taps; s++)
+            {
+                double k = a[s][r] / a[r][r];
+                for (int c = r; c <= taps; c++)
+                    a[s][c] -= k * a[r][c];
+            }
+
+        for (int r = taps - 1; r >= 0; r--)
+        {
+            h[r] = a[r][taps];
+            for (int c = r + 1; c < taps; c++)
+                h[r] -= a[r][c] * h[c];
+            h[r] /= a[r][r];
+        }
+
+        double signal = 0;
+        double error = 0;
+
+        for (size_t i = PDM_HARNESS_SETTLE; i < y.size(); i++)
+        {
+            double v = 0;
+            for (int t = 0; t < taps; t++)
+                v += h[t] * input[i - delay - t];
+
+            signal += v * v;
+            error += (y[i] - v) * (y[i] - v);
+        }
+
+        double snr = 10 * log10(signal / error);
+
+        if (snr > best)
+        {
+            best = snr;
+            bestDelay = delay;
+        }
+    }
+
+    printf("delay:       %d to %d samples\n", bestDelay, bestDelay + taps - 1);
+    printf("SNR:         %.1f dB\n", best);
+
+    return best;
+}
+
+/**
+ * Measures the frequency response of the filter, relative to the content of the bitstream at each frequency.
+ */
+static void sweep(const HarnessOptions &options, int rate)
+{
+    const int samples = 8192;
+    const double frequencies[] = {0.005, 0.01, 0.02, 0.05, 0.1, 0.15, 0.2, 0.25, 0.3, 0.35, 0.4, 0.45, 0.49};
+
+    printf("frequency response:\n");
+
+    for (double f : frequencies)
+    {
+        std::vector<int16_t> pcm(samples);
+        std::vector<uint32_t> pdm(samples * options.decimation / 16);
+        std::vector<double> bits(pdm.size() * 16);
+        PDMModulator modulator;
+
+        for (int i = 0; i < samples; i++)
+            pcm[i] = (int16_t) lround(16384 * sin(2 * M_PI * f * i));
+
+        modulator.modulate(pcm.data(), samples, pdm.data(), options.decimation);
+
+        for (size_t i = 0; i < bits.size(); i++)
+            bits[i] = (pdm[i / 16] >> (i % 16)) & 1 ? 32767 : -32768;
+
+        std::vector<int16_t> out = decode(pdm, options);
+        std::vector<double> y(out.begin() + PDM_HARNESS_SETTLE, out.end());
+
+        double input = hostFitSine(bits.data(), bits.size(), f / options.decimation).amplitude;
+        double output = hostFitSine(y.data(), y.size(), f).amplitude;
+
+        printf("  %8.1f Hz: %7.2f dB\n", f * rate, hostDecibels(output / input));
+    }
+}
+
+/**
+ * Measures the throughput of the filter, in output samples per second.
+ */
+static double throughput(const std::vector<uint32_t> &pdm, const HarnessOptions &options)
+{
+    double best = 0;
+
+    for (int run = 0; run < 3; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<int16_t> out = decode(pdm, options);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        if (out.size() / elapsed.count() > best)
+            best = out.size() / elapsed.count();
+    }
+
+    return best;
+}
+
+static void usage()
+{
+    printf("usage: pdm_harness [options]\n"
+           "  --wav FILE        modulate the first channel of a 16 bit PCM WAV file\n"
+           "  --sine HZ         modulate a sine wave of the given frequency (default 1000)\n"
+           "  --amplitude DBFS  the amplitude of the sine wave (default -6)\n"
+           "  --seconds S       the duration of the sine wave (default 1)\n"
+           "  --rate HZ         the output sample rate (default 22050, or that of the WAV file)\n"
+           "  --decimation N    PDM samples per output sample, so clockRate is rate * N (default 64)\n"
+           "  --filter NAME     sinc, or cic1 to cic4 (default sinc)\n"
+           "  --sweep           also measure the frequency response\n"
+           "  --expect DB       fail if the SINAD (sine) or SNR (WAV) is below this\n"
+           "  --pdm FILE        write the PDM bitstream, as raw 32 bit I2S words\n"
+           "  --out FILE        write the decoded output as a WAV file\n");
+}
+
+int main(int argc, char **argv)
+{
+    HarnessOptions options;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (arg == "--sweep")
+        {
+            options.sweep = true;
+            continue;
+        }
+
+        if (value == NULL)
+        {
+            usage();
+            return 1;
+        }
+
+        i++;
+
+        if (arg == "--wav")
+            options.wav = value;
+        else if (arg == "--sine")
+            options.sine = atof(value);
+        else if (arg == "--amplitude")
+            options.amplitude = atof(value);
+        else if (arg == "--seconds")
+            options.seconds = atof(value);
+        else if (arg == "--rate")
+            options.rate = atoi(value);
+        else if (arg == "--decimation")
+            options.decimation = atoi(value);
+        else if (arg == "--filter" && !strcmp(value, "sinc"))
+            options.stages = 0;
+        else if (arg == "--filter" && !strncmp(value, "cic", 3))
+            options.stages = atoi(value + 3);
+        else if (arg == "--expect")
+            options.expect = atof(value);
+        else if (arg == "--pdm")
+            options.pdm = value;
+        else if (arg == "--out")
+            options.out = value;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    if (options.stages == 0 && options.decimation != SINC_DECIMATOR_TAPS)
+    {
+        printf("the sinc filter requires a decimation of %d\n", SINC_DECIMATOR_TAPS);
+        return 1;
+    }
+
+    if (options.stages && CICDecimator().configure(options.decimation, options.stages) != DEVICE_OK)
+    {
+        printf("the CIC filter does not support a decimation of %d with %d stages\n", options.decimation, options.stages);
+        return 1;
+    }
+
+    std::vector<int16_t> input;
+    int rate = options.rate ? options.rate : 22050;
+
+    if (options.wav)
+    {
+        int wavRate = 0;
+
+        if (!readWav(options.wav, input, wavRate))
+        {
+            printf("could not read 16 bit PCM from %s\n", options.wav);
+            return 1;
+        }
+
+        // The modulator interpolates linearly between input samples, so the input must be at the output rate.
+        if (options.rate && options.rate != wavRate)
+            printf("using the sample rate of %s, %d Hz\n", options.wav, wavRate);
+
+        rate = wavRate;
+    }
+    else
+    {
+        double amplitude = 32768 * pow(10, options.amplitude / 20);
+
+        input.resize(lround(options.seconds * rate));
+        for (size_t i = 0; i < input.size(); i++)
+            input[i] = (int16_t) lround(amplitude * sin(2 * M_PI * options.sine * i / rate));
+    }
+
+    if ((int) input.size() <= 2 * PDM_HARNESS_SETTLE)
+    {
+        printf("the input is too short\n");
+        return 1;
+    }
+
+    std::vector<uint32_t> pdm(input.size() * options.decimation / 16);
+    PDMModulator modulator;
+    modulator.modulate(input.data(), input.size(), pdm.data(), options.decimation);
+
+    if (options.pdm)
+    {
+        FILE *f = fopen(options.pdm, "wb");
+        if (f)
+        {
+            fwrite(pdm.data(), sizeof(uint32_t), pdm.size(), f);
+            fclose(f);
+        }
+    }
+
+    std::vector<int16_t> output = decode(pdm, options);
+
+    if (options.out)
+        writeWav(options.out, output, rate);
+
+    printf("filter:      %s, decimation %d\n", options.stages ? ("CIC, " + std::to_string(options.stages) + " stages").c_str() : "sinc", options.decimation);
+    printf("clockRate:   %d Hz, for %d Hz output\n", rate * options.decimation, rate);
+
+    std::vector<double> y(output.begin() + PDM_HARNESS_SETTLE, output.end());
+    double quality = options.wav ? analyseSignal(std::vector<double>(output.begin(), output.end()), input) : analyseSine(y, options.sine / rate);
+
+    printf("throughput:  %.3g output samples per second\n", throughput(pdm, options));
+
+    if (options.sweep)
+        sweep(options, rate);
+
+    if (options.expect && !(quality >= options.expect))
+    {
+        printf("FAIL: %.1f dB is below the expected %.1f dB\n", quality, options.expect);
+        return 1;
+    }
+
+    return 0;
+}
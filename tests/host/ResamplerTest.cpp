@@ -0,0 +1,217 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "HostTest.h"
+#include "HostSignal.h"
+#include "PCMResampler.h"
+#include <stdio.h>
+#include <math.h>
+#include <set>
+#include <vector>
+
+/**
+ * Produces blocks of interleaved PCM, written by the test before each is announced.
+ */
+class BlockSource : public DataSource
+{
+public:
+
+    ManagedBuffer   block;
+
+    virtual ManagedBuffer pull()
+    {
+        return block;
+    }
+};
+
+/**
+ * Collects the samples produced by a resampler, optionally holding on to each buffer.
+ */
+class BlockSink : public DataSink
+{
+public:
+
+    DataSource                  *source = NULL;
+    std::vector<int16_t>        samples;
+    std::vector<ManagedBuffer>  held;
+    std::set<uint8_t *>         buffers;
+    bool                        hold = false;
+
+    virtual int pullRequest()
+    {
+        ManagedBuffer b = source->pull();
+        int16_t *p = (int16_t *) &b[0];
+
+        samples.insert(samples.end(), p, p + b.length() / sizeof(int16_t));
+        buffers.insert(&b[0]);
+
+        if (hold)
+            held.push_back(b);
+
+        return DEVICE_OK;
+    }
+};
+
+/**
+ * Feeds a block of a sine wave to a resampler.
+ *
+ * @param position The index of the first sample in the block, which is advanced past it.
+ * @param frequency The frequency of the sine wave, in cycles per input sample.
+ */
+static void feed(BlockSource &source, PCMResampler &resampler, int frames, int channels, long &position, double frequency)
+{
+    source.block = ManagedBuffer(frames * channels * sizeof(int16_t));
+    int16_t *p = (int16_t *) &source.block[0];
+
+    for (int i = 0; i < frames; i++, position++)
+        for (int c = 0; c < channels; c++)
+            *p++ = (int16_t) lround(16000 * sin(2 * M_PI * frequency * position));
+
+    resampler.pullRequest();
+}
+
+/**
+ * Converts the rate a SAMD21PDM microphone achieves for 16kHz (48MHz / 23 / 128) to exactly 16kHz, and checks the
+ * rate error and distortion of each method, within the band in which the polyphase filter is flat. Then checks that
+ * stereo channels are kept apart, that empty blocks are passed over, and that output buffers are recycled from the pool.
+ */
+HOST_TEST(resampler)
+{
+    const uint32_t inputRate = 48000000;
+    const uint32_t outputRate = 23 * 128 * 16000;
+    const double ratio = (double) outputRate / inputRate;
+    const int blocks = 2000;
+    const int settle = 64;
+    int failures = 0;
+
+    struct
+    {
+        int         method;
+        double      tone;
+        double      sinad;
+    } cases[] = {
+        {PCM_RESAMPLER_LINEAR, 1000, 40},
+        {PCM_RESAMPLER_LINEAR, 4000, 15},
+        {PCM_RESAMPLER_POLYPHASE, 1000, 60},
+        {PCM_RESAMPLER_POLYPHASE, 4000, 60},
+    };
+
+    for (unsigned t = 0; t < sizeof(cases) / sizeof(cases[0]); t++)
+    {
+        BlockSource source;
+        BlockSink sink;
+        PCMResampler resampler(source, inputRate, outputRate, 1, cases[t].method);
+        long position = 0;
+
+        resampler.connect(sink);
+        sink.source = &resampler;
+
+        for (int b = 0; b < blocks; b++)
+            feed(source, resampler, 256, 1, position, cases[t].tone * ratio / 16000);
+
+        // The output should follow the exact ratio, to within the filter delay.
+        double expected = position * ratio;
+        double rateError = (sink.samples.size() / expected - 1) * 1e6;
+
+        std::vector<double> y(sink.samples.begin() + settle, sink.samples.end());
+        HostSineFit fit = hostFitSine(y.data(), y.size(), cases[t].tone / 16000);
+
+        const char *method = cases[t].method == PCM_RESAMPLER_LINEAR ? "linear" : "polyphase";
+        printf("    %s %.0fHz: %d samples, rate error %.2f ppm, amplitude %.0f, SINAD %.1f dB\n", method, cases[t].tone, (int) sink.samples.size(), rateError, fit.amplitude, fit.sinad);
+
+        failures += hostCheck(fabs(sink.samples.size() - expected) <= PCM_RESAMPLER_TAPS, "%s %.0fHz: rate error of %.2f ppm", method, cases[t].tone, rateError);
+        failures += hostCheck(fit.sinad > cases[t].sinad, "%s %.0fHz: SINAD of %.1f dB", method, cases[t].tone, fit.sinad);
+        failures += hostCheck(sink.buffers.size() <= PCM_RESAMPLER_POOL_SIZE, "%s %.0fHz: %d distinct output buffers", method, cases[t].tone, (int) sink.buffers.size());
+    }
+
+    // Identical channels must remain identical, including across a change of block size.
+    {
+        BlockSource source;
+        BlockSink sink;
+        PCMResampler resampler(source, 3, 2, 2);
+        long position = 0;
+
+        resampler.connect(sink);
+        sink.source = &resampler;
+
+        feed(source, resampler, 200, 2, position, 0.01);
+        feed(source, resampler, PCM_RESAMPLER_DEFAULT_BLOCK_SIZE * 2, 2, position, 0.01);
+
+        int differences = 0;
+        for (size_t i = 0; i < sink.samples.size(); i += 2)
+            differences += sink.samples[i] != sink.samples[i + 1];
+
+        failures += hostCheck(sink.samples.size() > 2 * 400, "stereo: only %d samples", (int) sink.samples.size());
+        failures += hostCheck(differences == 0, "stereo: %d frames differ between channels", differences);
+    }
+
+    // An empty block produces no output, and leaves the stream where it was.
+    {
+        BlockSource source;
+        BlockSink sink;
+        PCMResampler resampler(source, 1, 1);
+        long position = 0;
+
+        resampler.connect(sink);
+        sink.source = &resampler;
+
+        feed(source, resampler, 64, 1, position, 0.01);
+        size_t received = sink.samples.size();
+
+        feed(source, resampler, 0, 1, position, 0.01);
+        failures += hostCheck(sink.samples.size() == received, "empty: %d samples received", (int) (sink.samples.size() - received));
+
+        feed(source, resampler, 64, 1, position, 0.01);
+        failures += hostCheck(sink.samples.size() == received + 64, "empty: %d samples received after", (int) (sink.samples.size() - received));
+    }
+
+    // Holding every buffer downstream drops output, which resumes once the buffers are released.
+    {
+        BlockSource source;
+        BlockSink sink;
+        PCMResampler resampler(source, 1, 1);
+        long position = 0;
+
+        resampler.connect(sink);
+        sink.source = &resampler;
+        sink.hold = true;
+
+        for (int b = 0; b < PCM_RESAMPLER_POOL_SIZE + 2; b++)
+            feed(source, resampler, 64, 1, position, 0.01);
+
+        failures += hostCheck(sink.held.size() == PCM_RESAMPLER_POOL_SIZE, "pool: %d buffers received while held", (int) sink.held.size());
+        failures += hostCheck(resampler.getPoolExhaustedCount() == 2, "pool: exhausted %d times", (int) resampler.getPoolExhaustedCount());
+
+        sink.held.clear();
+        sink.hold = false;
+        size_t received = sink.samples.size();
+
+        feed(source, resampler, 64, 1, position, 0.01);
+
+        failures += hostCheck(sink.samples.size() == received + 64, "pool: %d samples received after release", (int) (sink.samples.size() - received));
+    }
+
+    return failures;
+}
@@ -0,0 +1,214 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "HostTest.h"
+#include "SincDecimator.h"
+#include "PDMModulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+//
+// The filter taps of the original bit at a time decimator, against which the table driven engine is checked.
+//
+static const uint16_t referenceTaps[SINC_DECIMATOR_TAPS] = {
+    0, 2, 9, 21, 39, 63, 94, 132, 179, 236, 302, 379, 467, 565, 674, 792,
+    920, 1055, 1196, 1341, 1487, 1633, 1776, 1913, 2042, 2159, 2263, 2352, 2422, 2474, 2506, 2516,
+    2506, 2474, 2422, 2352, 2263, 2159, 2042, 1913, 1776, 1633, 1487, 1341, 1196, 1055, 920, 792,
+    674, 565, 467, 379, 302, 236, 179, 132, 94, 63, 39, 21, 9, 2, 0, 0};
+
+/**
+ * Filters one window of PDM data a bit at a time, as the original decimator did.
+ */
+static void referenceDecimate(const uint32_t *data, int32_t &left, int32_t &right)
+{
+    int32_t sum[2] = {0, 0};
+
+    for (int i = 0; i < SINC_DECIMATOR_TAPS; i++)
+    {
+        uint32_t word = data[i / 16];
+        int bit = i % 16;
+
+        if ((word >> bit) & 1)
+            sum[0] += referenceTaps[i];
+
+        if ((word >> (bit + 16)) & 1)
+            sum[1] += referenceTaps[i];
+    }
+
+    left = sum[0] - (1 << 15);
+    right = sum[1] - (1 << 15);
+}
+
+/**
+ * Compares every window of the given bitstream against the reference, in mono and stereo.
+ *
+ * @return the number of windows that differ.
+ */
+static int compare(const uint32_t *pdm, int windows)
+{
+    const int words = SINC_DECIMATOR_TAPS / 16;
+    int mismatches = 0;
+
+    for (int w = 0; w < windows; w++)
+    {
+        int32_t left, right, expectedLeft, expectedRight, monoLeft, unused;
+
+        referenceDecimate(&pdm[w * words], expectedLeft, expectedRight);
+        SincDecimator::decimate(&pdm[w * words], left, right, true);
+        SincDecimator::decimate(&pdm[w * words], monoLeft, unused, false);
+
+        if (left != expectedLeft || right != expectedRight || monoLeft != expectedLeft)
+            mismatches++;
+    }
+
+    return mismatches;
+}
+
+/**
+ * Reads a recorded PDM bitstream, held as the raw 32 bit words received from the I2S peripheral.
+ */
+static std::vector<uint32_t> load(const char *filename)
+{
+    std::vector<uint32_t> data;
+    FILE *f = fopen(filename, "rb");
+
+    if (f)
+    {
+        uint32_t word;
+        while (fread(&word, sizeof(word), 1, f) == 1)
+            data.push_back(word);
+
+        fclose(f);
+    }
+
+    return data;
+}
+
+/**
+ * Measures the cost of decimating the given bitstream.
+ *
+ * @return the cost of each output sample, in hostCycleUnit().
+ */
+template <typename F> static double benchmark(const std::vector<uint32_t> &pdm, F decimate)
+{
+    const int words = SINC_DECIMATOR_TAPS / 16;
+    int windows = pdm.size() / words;
+    volatile int32_t sink = 0;
+    uint64_t best = ~0ULL;
+
+    // Take the best of several runs, to exclude interference from the rest of the system.
+    for (int run = 0; run < 5; run++)
+    {
+        uint64_t start = hostCycles();
+
+        for (int w = 0; w < windows; w++)
+        {
+            int32_t left, right;
+            decimate(&pdm[w * words], left, right);
+            sink = sink + left + right;
+        }
+
+        uint64_t elapsed = hostCycles() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    return (double) best / windows;
+}
+
+/**
+ * Checks that the decimator selected by SAMD21_PDM_LUT_DECIMATION is bit exact against the original bit at a time
+ * filter, and reports the cost of each output sample.
+ *
+ * Recorded PDM bitstreams can be given as arguments. Otherwise, random data and modulated sine waves are used.
+ */
+HOST_TEST(sinc)
+{
+    const int words = SINC_DECIMATOR_TAPS / 16;
+    const int samples = 44100;
+    int failures = 0;
+
+    std::vector<std::vector<uint32_t>> streams;
+
+    for (int i = 0; i < argc; i++)
+    {
+        std::vector<uint32_t> data = load(argv[i]);
+        failures += hostCheck(data.size() >= words, "could not read a PDM recording from %s", argv[i]);
+        streams.push_back(data);
+    }
+
+    if (argc == 0)
+    {
+        // Random data exercises every byte value in every position of the window.
+        std::vector<uint32_t> random(samples * words);
+        srand(1);
+        for (auto &w : random)
+            w = (uint32_t) rand() ^ ((uint32_t) rand() << 16);
+
+        streams.push_back(random);
+
+        // A 1 kHz tone on the left channel and 3 kHz on the right, at the largest amplitude the modulator supports.
+        std::vector<int16_t> left(samples), right(samples);
+        for (int i = 0; i < samples; i++)
+        {
+            left[i] = (int16_t) lround(24000 * sin(2 * M_PI * 1000 * i / samples));
+            right[i] = (int16_t) lround(24000 * sin(2 * M_PI * 3000 * i / samples));
+        }
+
+        std::vector<uint32_t> tone(samples * words);
+        PDMModulator l, r;
+        l.modulate(left.data(), samples, tone.data(), SINC_DECIMATOR_TAPS, 0);
+        r.modulate(right.data(), samples, tone.data(), SINC_DECIMATOR_TAPS, 1);
+
+        streams.push_back(tone);
+
+        // Silence and full scale in both directions.
+        streams.push_back(std::vector<uint32_t>(words * 4, 0));
+        streams.push_back(std::vector<uint32_t>(words * 4, 0xFFFFFFFF));
+        streams.push_back(std::vector<uint32_t>(words * 4, 0x0000FFFF));
+    }
+
+    for (size_t s = 0; s < streams.size(); s++)
+    {
+        int windows = streams[s].size() / words;
+        int mismatches = compare(streams[s].data(), windows);
+
+        printf("    stream %d: %d windows, %d mismatches\n", (int) s, windows, mismatches);
+        failures += hostCheck(mismatches == 0, "stream %d is not bit exact against the reference filter", (int) s);
+    }
+
+    const std::vector<uint32_t> &pdm = streams[argc == 0 ? 1 : 0];
+
+    double mono = benchmark(pdm, [](const uint32_t *d, int32_t &l, int32_t &r) { SincDecimator::decimate(d, l, r, false); });
+    double stereo = benchmark(pdm, [](const uint32_t *d, int32_t &l, int32_t &r) { SincDecimator::decimate(d, l, r, true); });
+    double reference = benchmark(pdm, referenceDecimate);
+
+    printf("    %s engine: %.1f %s per mono output sample, %.1f per stereo output sample\n",
+        CONFIG_ENABLED(SAMD21_PDM_LUT_DECIMATION) ? "lookup table" : "bitwise", mono, hostCycleUnit(), stereo);
+    printf("    reference bitwise filter: %.1f %s per stereo output sample\n", reference, hostCycleUnit());
+
+    return failures;
+}
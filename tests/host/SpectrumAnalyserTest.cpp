@@ -0,0 +1,192 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "HostTest.h"
+#include "SpectrumAnalyser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <set>
+#include <vector>
+
+/**
+ * Produces buffers of a sine wave on request.
+ */
+class ToneSource : public DataSource
+{
+public:
+
+    DataSink    *sink = NULL;
+    double      frequency = 0;
+    int         position = 0;
+
+    virtual ManagedBuffer pull()
+    {
+        ManagedBuffer b(128 * sizeof(int16_t));
+        int16_t *p = (int16_t *) &b[0];
+
+        for (int i = 0; i < 128; i++, position++)
+            p[i] = (int16_t) lround(16000 * sin(2 * M_PI * frequency * position));
+
+        return b;
+    }
+
+    virtual void connect(DataSink &sink)
+    {
+        this->sink = &sink;
+    }
+};
+
+/**
+ * Collects the spectra published by an analyser, optionally holding on to them.
+ */
+class SpectrumSink : public DataSink
+{
+public:
+
+    DataSource                  *source = NULL;
+    std::vector<ManagedBuffer>  held;
+    std::set<uint8_t *>         buffers;
+    bool                        hold = false;
+    int                         received = 0;
+
+    virtual int pullRequest()
+    {
+        ManagedBuffer b = source->pull();
+
+        buffers.insert(&b[0]);
+        received++;
+
+        if (hold)
+            held.push_back(b);
+
+        return DEVICE_OK;
+    }
+};
+
+/**
+ * Checks the fixed point transform against a double precision DFT at every supported size, and reports its cost.
+ * Then checks that a streaming analyser recycles its spectrum buffers.
+ */
+HOST_TEST(spectrum)
+{
+    int failures = 0;
+
+    srand(1);
+
+    for (int size = SPECTRUM_ANALYSER_MIN_SIZE; size <= SPECTRUM_ANALYSER_MAX_SIZE; size *= 2)
+    {
+        std::vector<int16_t> samples(size), work(size);
+        std::vector<uint16_t> magnitude(size / 2);
+
+        // Two tones, one between bins, and some noise.
+        double bin = size / 8 + 1;
+        for (int i = 0; i < size; i++)
+            samples[i] = (int16_t) lround(20000 * sin(2 * M_PI * bin * i / size) + 8000 * sin(2 * M_PI * (size / 4 + 0.5) * i / size + 1) + (rand() % 512 - 256));
+
+        SpectrumAnalyser::transform(samples.data(), work.data(), magnitude.data(), size);
+
+        // A Hann windowed DFT, scaled so that a full scale sine wave has a magnitude of about 16384.
+        double worst = 0;
+        int peak = 1;
+
+        for (int k = 0; k < size / 2; k++)
+        {
+            double re = 0, im = 0;
+
+            for (int i = 0; i < size; i++)
+            {
+                double w = pow(sin(M_PI * i / size), 2);
+                re += samples[i] * w * cos(2 * M_PI * k * i / size);
+                im -= samples[i] * w * sin(2 * M_PI * k * i / size);
+            }
+
+            double expected = 2 * sqrt(re * re + im * im) / size;
+
+            if (fabs(magnitude[k] - expected) > worst)
+                worst = fabs(magnitude[k] - expected);
+
+            if (k > 0 && magnitude[k] > magnitude[peak])
+                peak = k;
+        }
+
+        // Measure the cost of a transform.
+        volatile int sink = 0;
+        uint64_t best = ~0ULL;
+        int runs = 20000 / size;
+
+        for (int r = 0; r < 5; r++)
+        {
+            uint64_t start = hostCycles();
+
+            for (int i = 0; i < runs; i++)
+            {
+                SpectrumAnalyser::transform(samples.data(), work.data(), magnitude.data(), size);
+                sink = sink + magnitude[0];
+            }
+
+            uint64_t elapsed = (hostCycles() - start) / runs;
+            if (elapsed < best)
+                best = elapsed;
+        }
+
+        printf("    size %3d: peak bin %d, worst error %.1f, %llu %s per transform (%.1f per sample)\n",
+            size, peak, worst, (unsigned long long) best, hostCycleUnit(), (double) best / size);
+
+        failures += hostCheck(peak == (int) bin, "size %d: the peak is in bin %d, not %d", size, peak, (int) bin);
+        failures += hostCheck(worst < 32, "size %d: a bin differs from the reference by %.1f", size, worst);
+    }
+
+    // Stream a tone through an analyser, and check that it only ever publishes its pooled buffers.
+    ToneSource source;
+    SpectrumAnalyser analyser(source, 64);
+    SpectrumSink sink;
+
+    source.frequency = 8.0 / 64;
+    sink.source = &analyser;
+    analyser.connect(sink);
+
+    for (int i = 0; i < 100; i++)
+        source.sink->pullRequest();
+
+    failures += hostCheck(sink.received == 100 * 128 / 32 - 1, "%d spectra were published, expected %d", sink.received, 100 * 128 / 32 - 1);
+    failures += hostCheck(sink.buffers.size() <= SPECTRUM_ANALYSER_POOL_SIZE, "%d distinct buffers were published", (int) sink.buffers.size());
+    failures += hostCheck(analyser.getPeakBin() == 8, "the peak is in bin %d, not 8", analyser.getPeakBin());
+    failures += hostCheck(analyser.getPoolExhaustedCount() == 0, "%d spectra were dropped", (int) analyser.getPoolExhaustedCount());
+
+    // If the sink holds on to every spectrum, the pool runs dry and further spectra are dropped. None of the pooled
+    // buffers were held before, so each can be published once.
+    sink.hold = true;
+    sink.received = 0;
+
+    for (int i = 0; i < 4; i++)
+        source.sink->pullRequest();
+
+    failures += hostCheck(sink.received == SPECTRUM_ANALYSER_POOL_SIZE, "%d spectra were published while held, expected %d", sink.received, SPECTRUM_ANALYSER_POOL_SIZE);
+    failures += hostCheck((int) analyser.getPoolExhaustedCount() == 16 - sink.received, "%d spectra were dropped, expected %d", (int) analyser.getPoolExhaustedCount(), 16 - sink.received);
+
+    printf("    streaming: %d distinct buffers published, %d spectra dropped while held\n", (int) sink.buffers.size(), (int) analyser.getPoolExhaustedCount());
+
+    return failures;
+}
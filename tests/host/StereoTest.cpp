@@ -0,0 +1,148 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "HostTest.h"
+#include "HostSignal.h"
+#include "SincDecimator.h"
+#include "CICDecimator.h"
+#include "PDMModulator.h"
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+/**
+ * Decodes a two channel bitstream in a single pass, with both of the filters used by SAMD21PDM,
+ * splitting each 32 bit word between the channels in the same way.
+ *
+ * @param pdm The bitstream, with SINC_DECIMATOR_TAPS / 16 words per output sample.
+ * @param samples The number of output samples to decode.
+ * @param stages The number of CIC stages, or zero for the sinc filter.
+ * @param left Set to the left channel samples.
+ * @param right Set to the right channel samples.
+ */
+static void decode(const std::vector<uint32_t> &pdm, int samples, int stages, std::vector<double> &left, std::vector<double> &right)
+{
+    const uint32_t *b = pdm.data();
+    CICDecimator cic[2] = {CICDecimator(SINC_DECIMATOR_TAPS, stages ? stages : 1), CICDecimator(SINC_DECIMATOR_TAPS, stages ? stages : 1)};
+
+    left.resize(samples);
+    right.resize(samples);
+
+    for (int i = 0; i < samples; i++)
+    {
+        int32_t sample[2];
+
+        if (stages)
+        {
+            for (int w = 0; w < SINC_DECIMATOR_TAPS / 16; w++)
+            {
+                uint32_t word = *b++;
+                cic[0].integrate(word & 0xFFFF);
+                cic[1].integrate(word >> 16);
+            }
+
+            sample[0] = cic[0].decimate();
+            sample[1] = cic[1].decimate();
+        }
+        else
+        {
+            SincDecimator::decimate(b, sample[0], sample[1], true);
+            b += SINC_DECIMATOR_TAPS / 16;
+        }
+
+        left[i] = sample[0];
+        right[i] = sample[1];
+    }
+}
+
+/**
+ * Modulates a tone into one channel of a bitstream.
+ *
+ * @param frequency The frequency of the tone in cycles per output sample, or zero for silence.
+ */
+static void modulate(std::vector<uint32_t> &pdm, int samples, double frequency, int channel)
+{
+    std::vector<int16_t> pcm(samples);
+    PDMModulator modulator;
+
+    for (int i = 0; i < samples; i++)
+        pcm[i] = (int16_t) lround(16384 * sin(2 * M_PI * frequency * i));
+
+    modulator.modulate(pcm.data(), samples, pdm.data(), SINC_DECIMATOR_TAPS, channel);
+}
+
+/**
+ * Decodes synthetic dual microphone bitstreams, with a different tone in each channel, and checks that
+ * each channel carries its own tone without crosstalk from the other.
+ */
+HOST_TEST(stereo)
+{
+    const int samples = 8192;
+    const int settle = 64;
+    const double tone[2] = {1000.0 / 22050, 3000.0 / 22050};
+    int failures = 0;
+
+    std::vector<uint32_t> both(samples * SINC_DECIMATOR_TAPS / 16);
+    std::vector<uint32_t> leftOnly(both.size());
+    std::vector<uint32_t> rightOnly(both.size());
+
+    modulate(both, samples, tone[0], 0);
+    modulate(both, samples, tone[1], 1);
+    modulate(leftOnly, samples, tone[0], 0);
+    modulate(leftOnly, samples, 0, 1);
+    modulate(rightOnly, samples, 0, 0);
+    modulate(rightOnly, samples, tone[1], 1);
+
+    for (int stages = 0; stages <= CIC_DECIMATOR_MAX_STAGES; stages++)
+    {
+        std::vector<double> out[2], leftAlone[2], rightAlone[2];
+
+        decode(both, samples, stages, out[0], out[1]);
+        decode(leftOnly, samples, stages, leftAlone[0], leftAlone[1]);
+        decode(rightOnly, samples, stages, rightAlone[0], rightAlone[1]);
+
+        // Each channel must decode identically whatever the other channel holds.
+        int differences = 0;
+        for (int i = 0; i < samples; i++)
+            differences += out[0][i] != leftAlone[0][i] || out[1][i] != rightAlone[1][i];
+
+        const char *filter = stages ? "cic" : "sinc";
+        failures += hostCheck(differences == 0, "%s %d: %d samples differ from the channels decoded alone", filter, stages, differences);
+
+        for (int c = 0; c < 2; c++)
+        {
+            HostSineFit own = hostFitSine(&out[c][settle], samples - settle, tone[c]);
+            HostSineFit other = hostFitSine(&out[c][settle], samples - settle, tone[1 - c]);
+            double crosstalk = hostDecibels(other.amplitude / own.amplitude);
+
+            printf("    %s %d %s: amplitude %.0f, SINAD %.1f dB, crosstalk %.1f dB\n", filter, stages, c ? "right" : "left", own.amplitude, own.sinad, crosstalk);
+
+            failures += hostCheck(own.amplitude > 8192 && own.amplitude < 24576, "%s %d: channel %d has amplitude %.0f", filter, stages, c, own.amplitude);
+            failures += hostCheck(own.sinad > 20, "%s %d: channel %d has SINAD %.1f dB", filter, stages, c, own.sinad);
+            failures += hostCheck(crosstalk < -60, "%s %d: channel %d has crosstalk of %.1f dB", filter, stages, c, crosstalk);
+        }
+    }
+
+    return failures;
+}
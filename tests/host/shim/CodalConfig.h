@@ -0,0 +1,47 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef HOST_CODAL_CONFIG_H
+#define HOST_CODAL_CONFIG_H
+
+//
+// A minimal stand in for the CodalConfig.h provided by a CODAL target, so that the hardware independent
+// components of this library can be built and tested on the host.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define CONFIG_ENABLED(X) (X == 1)
+#define CONFIG_DISABLED(X) (X != 1)
+
+#define DEVICE_OK                   0
+#define DEVICE_INVALID_PARAMETER    -1001
+#define DEVICE_NOT_SUPPORTED        -1002
+#define DEVICE_BUSY                 -1004
+#define DEVICE_NO_RESOURCES         -1005
+#define DEVICE_NO_DATA              -1011
+
+#endif
@@ -0,0 +1,106 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef HOST_DATA_STREAM_H
+#define HOST_DATA_STREAM_H
+
+#include "ManagedBuffer.h"
+
+namespace codal
+{
+    /**
+     * Interface definition for a component that consumes a stream of buffers.
+     */
+    class DataSink
+    {
+    public:
+
+        virtual int pullRequest()
+        {
+            return DEVICE_NOT_SUPPORTED;
+        }
+
+        virtual ~DataSink()
+        {
+        }
+    };
+
+    /**
+     * Interface definition for a component that produces a stream of buffers.
+     */
+    class DataSource
+    {
+    public:
+
+        virtual ManagedBuffer pull()
+        {
+            return ManagedBuffer();
+        }
+
+        virtual void connect(DataSink &)
+        {
+        }
+
+        virtual ~DataSource()
+        {
+        }
+    };
+
+    /**
+     * A host implementation of the codal-core DataStream, without buffering. Each pullRequest is passed
+     * straight to the connected sink, which pulls straight from the upstream component.
+     */
+    class DataStream : public DataSource, public DataSink
+    {
+        DataSource  &upstream;
+        DataSink    *downstream;
+
+    public:
+
+        DataStream(DataSource &upstream) : upstream(upstream), downstream(NULL)
+        {
+        }
+
+        virtual int pullRequest()
+        {
+            return downstream ? downstream->pullRequest() : DEVICE_OK;
+        }
+
+        virtual ManagedBuffer pull()
+        {
+            return upstream.pull();
+        }
+
+        virtual void connect(DataSink &sink)
+        {
+            downstream = &sink;
+        }
+
+        void setBlocking(bool)
+        {
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,181 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 Lancaster University.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef HOST_MANAGED_BUFFER_H
+#define HOST_MANAGED_BUFFER_H
+
+#include "CodalConfig.h"
+#include <stdlib.h>
+
+namespace codal
+{
+    /**
+     * The reference counted storage behind a ManagedBuffer, laid out as in codal-core.
+     * The empty buffer is marked read only by a reference count of 0xFFFF, and is never counted or freed.
+     */
+    struct BufferData
+    {
+        uint16_t refCount;                              // The number of references held to this buffer.
+        uint16_t length;                                // The number of bytes in the payload.
+        uint8_t payload[0];                             // The data itself.
+
+        void incr()
+        {
+            if (refCount != 0xFFFF)
+                refCount++;
+        }
+
+        void decr()
+        {
+            if (refCount != 0xFFFF && --refCount == 0)
+                free(this);
+        }
+    };
+
+    /**
+     * A host implementation of the codal-core ManagedBuffer, with the same reference counting semantics.
+     * In particular, leakData() keeps the reference held by the buffer it is called on, so a component can
+     * hold a pool of buffers and detect when each is idle from its reference count.
+     */
+    class ManagedBuffer
+    {
+        BufferData *ptr;
+
+        static BufferData *empty()
+        {
+            static BufferData data = { 0xFFFF, 0 };
+            return &data;
+        }
+
+        void init(const uint8_t *data, int length)
+        {
+            if (length <= 0)
+            {
+                ptr = empty();
+                return;
+            }
+
+            ptr = (BufferData *) malloc(sizeof(BufferData) + length);
+            ptr->refCount = 1;
+            ptr->length = length;
+
+            if (data)
+                memcpy(ptr->payload, data, length);
+            else
+                memset(ptr->payload, 0, length);
+        }
+
+        void incr()
+        {
+            if (ptr != empty())
+                ptr->incr();
+        }
+
+        void decr()
+        {
+            if (ptr != empty())
+                ptr->decr();
+        }
+
+    public:
+
+        ManagedBuffer()
+        {
+            ptr = empty();
+        }
+
+        ManagedBuffer(int length)
+        {
+            init(NULL, length);
+        }
+
+        ManagedBuffer(uint8_t *data, int length)
+        {
+            init(data, length);
+        }
+
+        ManagedBuffer(BufferData *p)
+        {
+            ptr = p;
+            incr();
+        }
+
+        ManagedBuffer(const ManagedBuffer &buffer)
+        {
+            ptr = buffer.ptr;
+            incr();
+        }
+
+        ~ManagedBuffer()
+        {
+            decr();
+        }
+
+        ManagedBuffer& operator = (const ManagedBuffer &p)
+        {
+            if (ptr != p.ptr)
+            {
+                decr();
+                ptr = p.ptr;
+                incr();
+            }
+
+            return *this;
+        }
+
+        bool operator == (const ManagedBuffer &p) const
+        {
+            return ptr == p.ptr;
+        }
+
+        uint8_t &operator [] (int i)
+        {
+            return ptr->payload[i];
+        }
+
+        uint8_t operator [] (int i) const
+        {
+            return ptr->payload[i];
+        }
+
+        uint8_t *getBytes()
+        {
+            return ptr->payload;
+        }
+
+        int length() const
+        {
+            return ptr->length;
+        }
+
+        BufferData *leakData()
+        {
+            BufferData *p = ptr;
+            ptr = empty();
+            return p;
+        }
+    };
+}
+
+#endif